@@ -0,0 +1,330 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <boost/program_options.hpp>
+
+#include "nebulagen.hpp"
+#include "volumelighting.hpp"
+#include "volumeparticletransform.hpp"
+#include "particlelighting.hpp"
+#include "simplex.hpp"
+
+/*
+ * Benchmarks of the generation pipeline with fixed seeds. Every result carries a checksum of its output,
+ * so that a change in speed and a change in output are caught by the same run.
+ *
+ * Micro benchmarks time the inner loops of the stages, macro benchmarks time whole stages on volumes of increasing size;
+ * the smaller volumes are decimated from the generated 256^3 dust.
+ */
+
+struct result_t
+{
+	std::string name;
+	size_t size; // Volume resolution, 0 for micro benchmarks
+	double seconds;
+	uint64_t items;
+	std::string unit;
+	uint64_t checksum;
+};
+
+/* FNV-1a over the bytes of the output */
+class checksum_t
+{
+	uint64_t m_hash = 14695981039346656037ull;
+
+public:
+	void add(const void* data, const size_t n)
+	{
+		const uint8_t* bytes = (const uint8_t*)data;
+		for(size_t i = 0; i < n; ++i)
+		{
+			m_hash ^= bytes[i];
+			m_hash *= 1099511628211ull;
+		}
+	}
+
+	template<typename T>
+	void add(const T& x)
+	{
+		add(&x, sizeof(T));
+	}
+
+	uint64_t value() const
+	{
+		return m_hash;
+	}
+};
+
+static double time_call(const std::function<void()>& f)
+{
+	const auto begin = std::chrono::steady_clock::now();
+	f();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void report(std::vector<result_t>& results, const result_t& r)
+{
+	std::cerr << std::left << std::setw(20) << r.name << std::right << std::setw(5) << (r.size > 0 ? std::to_string(r.size) : "-")
+		<< std::setw(12) << std::fixed << std::setprecision(4) << r.seconds << " s"
+		<< std::setw(16) << std::setprecision(0) << (r.items / r.seconds) << " " << r.unit << "/s" << std::endl;
+
+	results.push_back(r);
+}
+
+static void micro_benchmarks(std::vector<result_t>& results, const int seed)
+{
+	static constexpr size_t noise_samples = 1 << 20;
+	static constexpr size_t chunks = 8;
+	static constexpr size_t lookups = 1 << 20;
+	static constexpr size_t sort_size = 1 << 22;
+
+	std::default_random_engine engine(seed);
+	std::uniform_real_distribution<GLfloat> unit(0.0f, 1.0f);
+
+	{
+		const simplex s(seed);
+		GLfloat sum = 0.0f;
+		const double t = time_call([&]() {
+			for(size_t i = 0; i < noise_samples; ++i)
+				sum += s.octave_noise(5.0f, 0.6f, 1.0f, glm::vec3(i % 128, (i / 128) % 128, i / (128 * 128)) / 128.0f);
+		});
+
+		checksum_t c;
+		c.add(sum);
+		report(results, {"noise", 0, t, noise_samples, "samples", c.value()});
+	}
+
+	{
+		// Whole chunks: the clouds of the chunk and its 26 neighbours are drawn into it, then turned into dust
+		const nebulagen gen(seed);
+		checksum_t c;
+		const double t = time_call([&]() {
+			for(size_t i = 0; i < chunks; ++i)
+			{
+				const nebulagen::chunk_t chunk = gen.generate_chunk(glm::ivec3(i, 0, 0));
+				c.add(chunk.data(), chunk.size * sizeof(nebulagen::dust_t));
+			}
+		});
+
+		report(results, {"generate_chunk", 0, t, chunks * nebulagen::chunk_t::size, "voxels", c.value()});
+	}
+
+	{
+		typedef volumelighting<nebulagen::CHUNK, nebulagen::CHUNK, nebulagen::CHUNK, nebulagen::dust_t, nebulagen::light_t> lighting_t;
+
+		const volume_nebula_t<nebulagen::CHUNK, nebulagen::CHUNK, nebulagen::CHUNK, nebulagen::dust_t> nebula(nebulagen(seed).generate_chunk(glm::ivec3(1, 0, 0)), nebulagen::generate_stars());
+		volume<nebulagen::light_t, nebulagen::CHUNK, nebulagen::CHUNK, nebulagen::CHUNK> light;
+
+		const double t = time_call([&]() {
+			lighting_t::light_slab(nebula, light, 0, nebulagen::CHUNK);
+		});
+
+		checksum_t c;
+		c.add(light.data(), light.size * sizeof(nebulagen::light_t));
+		report(results, {"shadow_rays", 0, t, light.size * nebula.stars.size(), "rays", c.value()});
+	}
+
+	{
+		std::vector<glm::vec3> targets(lookups);
+		for(glm::vec3& p : targets)
+			p = glm::vec3(unit(engine), unit(engine), unit(engine));
+
+		const glm::vec3 source(0.5f, 0.5f, 0.5f);
+		size_t sum = 0;
+		const double t = time_call([&]() {
+			for(const glm::vec3& p : targets)
+				sum += particlelighting::light_bin(source, p);
+		});
+
+		checksum_t c;
+		c.add(sum);
+		report(results, {"bin_lookup", 0, t, lookups, "lookups", c.value()});
+	}
+
+	{
+		std::vector<GLfloat> zs(sort_size);
+		for(GLfloat& z : zs)
+			z = unit(engine);
+
+		std::vector<size_t> index(sort_size);
+		std::iota(index.begin(), index.end(), 0);
+
+		// Same pattern as the particle lighting: an index sorted by distance
+		const double t = time_call([&]() {
+			std::sort(index.begin(), index.end(), [&](const size_t a, const size_t b) {
+				return zs[a] < zs[b];
+			});
+		});
+
+		checksum_t c;
+		c.add(index.data(), index.size() * sizeof(size_t));
+		report(results, {"sort", 0, t, sort_size, "elements", c.value()});
+	}
+}
+
+/* Every step-th voxel of the full dust along each axis */
+template<size_t N>
+static volume<nebulagen::dust_t, N, N, N> decimate(const volume<nebulagen::dust_t, nebulagen::X, nebulagen::Y, nebulagen::Z>& dust)
+{
+	static constexpr size_t step = nebulagen::SIZE / N;
+
+	volume<nebulagen::dust_t, N, N, N> result;
+	for(size_t x = 0; x < N; ++x)
+		for(size_t y = 0; y < N; ++y)
+			for(size_t z = 0; z < N; ++z)
+				result[glm::uvec3(x, y, z)] = dust[glm::uvec3(x * step, y * step, z * step)];
+
+	return result;
+}
+
+template<size_t N>
+static void macro_benchmarks(std::vector<result_t>& results, const nebulagen::nebula_t& full, const int seed)
+{
+	typedef volume_nebula_t<N, N, N, nebulagen::dust_t> nebula_t;
+
+	const nebula_t source(decimate<N>(full.dust), full.stars);
+
+	{
+		nebula_t nebula = source;
+		const double t = time_call([&]() {
+			volumelighting<N, N, N, nebulagen::dust_t, nebulagen::light_t>::apply_lighting(nebula);
+		});
+
+		checksum_t c;
+		c.add(nebula.dust.data(), nebula.dust.size * sizeof(nebulagen::dust_t));
+		report(results, {"volume_lighting", N, t, nebula.dust.size, "voxels", c.value()});
+	}
+
+	// Keeps the particles per voxel of the full volume
+	const size_t budget = 500000 * (N * N * N) / (nebulagen::X * nebulagen::Y * nebulagen::Z);
+
+	particle_nebula_t pnebula(source.stars);
+	{
+		const double t = time_call([&]() {
+			pnebula.particles = volume_to_particles(source.dust, seed, budget);
+		});
+
+		checksum_t c;
+		c.add(pnebula.particles.data(), pnebula.particles.size() * sizeof(particle_t));
+		report(results, {"particles", N, t, pnebula.particles.size(), "particles", c.value()});
+	}
+
+	{
+		const double t = time_call([&]() {
+			particlelighting::apply_lighting(pnebula);
+		});
+
+		checksum_t c;
+		c.add(pnebula.particles.data(), pnebula.particles.size() * sizeof(particle_t));
+		report(results, {"particle_lighting", N, t, pnebula.particles.size(), "particles", c.value()});
+	}
+}
+
+static void write_json(std::ostream& os, const std::string& preset, const int seed, const std::vector<result_t>& results)
+{
+	checksum_t total;
+	for(const result_t& r : results)
+		total.add(r.checksum);
+
+	os << "{" << std::endl
+		<< "\t\"preset\": \"" << preset << "\"," << std::endl
+		<< "\t\"seed\": " << seed << "," << std::endl
+		<< "\t\"checksum\": \"" << std::hex << std::setw(16) << std::setfill('0') << total.value() << std::dec << std::setfill(' ') << "\"," << std::endl
+		<< "\t\"results\": [" << std::endl;
+
+	for(size_t i = 0; i < results.size(); ++i)
+	{
+		const result_t& r = results[i];
+		os << "\t\t{\"name\": \"" << r.name << "\", \"size\": " << r.size
+			<< ", \"seconds\": " << std::setprecision(9) << r.seconds
+			<< ", \"items\": " << r.items
+			<< ", \"unit\": \"" << r.unit << "\""
+			<< ", \"per_second\": " << std::setprecision(9) << (r.items / r.seconds)
+			<< ", \"checksum\": \"" << std::hex << std::setw(16) << std::setfill('0') << r.checksum << std::dec << std::setfill(' ') << "\"}"
+			<< (i + 1 < results.size() ? "," : "") << std::endl;
+	}
+
+	os << "\t]" << std::endl
+		<< "}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+	std::string preset = "small", output = "nebula_bench.json";
+	int seed = 4821903;
+
+	boost::program_options::options_description options("Allowed options");
+	options.add_options()
+			("help,h", "display this message")
+			("preset,p", boost::program_options::value(&preset), "{small, large} small runs the micro benchmarks and the 64^3 stages, large adds 128^3 and 256^3 (defaults to small)")
+			("output,o", boost::program_options::value(&output), "file to write the JSON results to (defaults to nebula_bench.json)")
+			("seed,i", boost::program_options::value(&seed), "any number (defaults to 4821903)");
+
+	boost::program_options::variables_map vm;
+	try
+	{
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, options), vm);
+		boost::program_options::notify(vm);
+	} catch(const boost::program_options::error& e)
+	{
+		std::cerr << e.what() << ", see --help" << std::endl;
+		return 2;
+	}
+
+	if(vm.count("help"))
+	{
+		std::cout << "Benchmarks of the nebula generation pipeline" << std::endl
+			<< "Usage: ./nebula_bench [options]" << std::endl
+			<< std::endl
+			<< options;
+
+		return 1;
+	}
+
+	if(preset != "small" && preset != "large")
+	{
+		std::cerr << "Unrecognized preset \"" << preset << "\"" << std::endl;
+		return 1;
+	}
+
+	std::vector<result_t> results;
+	micro_benchmarks(results, seed);
+
+	nebulagen::nebula_t full;
+	{
+		nebulagen gen(seed);
+		const double t = time_call([&]() {
+			full = gen.generate();
+		});
+
+		checksum_t c;
+		c.add(full.dust.data(), full.dust.size * sizeof(nebulagen::dust_t));
+		report(results, {"generate", nebulagen::SIZE, t, full.dust.size, "voxels", c.value()});
+	}
+
+	macro_benchmarks<64>(results, full, seed);
+	if(preset == "large")
+	{
+		macro_benchmarks<128>(results, full, seed);
+		macro_benchmarks<256>(results, full, seed);
+	}
+
+	std::ofstream os(output);
+	write_json(os, preset, seed, results);
+	if(!os)
+	{
+		std::cerr << "Could not write " << output << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
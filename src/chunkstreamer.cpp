@@ -0,0 +1,121 @@
+#include "chunkstreamer.hpp"
+
+#include <algorithm>
+
+#include "util/trace.hpp"
+
+GLfloat chunkstreamer::priority(const glm::ivec3& coord, const glm::vec3& camera, const glm::vec3& direction)
+{
+	const glm::vec3 to_chunk = glm::vec3(coord.x, coord.y, coord.z) + glm::vec3(0.5f) - camera;
+	const GLfloat distance = glm::length(to_chunk);
+
+	return glm::dot(to_chunk, direction) < 0.0f ? 2.0f * distance : distance;
+}
+
+chunkstreamer::chunkstreamer(const int seed, const size_t thread_count)
+: m_gen(seed)
+, m_mutex()
+, m_cv()
+, m_pending()
+, m_busy()
+, m_ready()
+, m_stop(false)
+, m_threads()
+{
+	for(size_t i = 0; i < std::max<size_t>(thread_count, 1); ++i)
+		m_threads.emplace_back([this]() { run(); });
+}
+
+chunkstreamer::~chunkstreamer()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+
+	m_cv.notify_all();
+	for(std::thread& t : m_threads)
+		t.join();
+}
+
+void chunkstreamer::run()
+{
+	trace::name_thread("chunk streamer");
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(true)
+	{
+		m_cv.wait(lock, [this]() { return m_stop || !m_pending.empty(); });
+
+		if(m_stop)
+			return;
+
+		const glm::ivec3 coord = m_pending.back();
+		m_pending.pop_back();
+		m_busy[coord] = true;
+
+		lock.unlock();
+		chunk_ptr chunk = std::make_shared<const nebulagen::chunk_t>(m_gen.generate_chunk(coord)); // Const; safe to call concurrently
+		lock.lock();
+
+		if(m_busy[coord])
+			m_ready.push_back({coord, chunk});
+
+		m_busy.erase(coord);
+	}
+}
+
+void chunkstreamer::request(const std::vector<glm::ivec3>& wanted, const glm::vec3& camera, const glm::vec3& direction)
+{
+	std::vector<std::pair<GLfloat, glm::ivec3>> order;
+	order.reserve(wanted.size());
+
+	for(const glm::ivec3& coord : wanted)
+		order.push_back(std::make_pair(priority(coord, camera, direction), coord));
+
+	std::sort(order.begin(), order.end(), [](const std::pair<GLfloat, glm::ivec3>& a, const std::pair<GLfloat, glm::ivec3>& b) {
+		return a.first > b.first;
+	});
+
+	std::map<glm::ivec3, bool, chunk_less> is_wanted;
+	for(const glm::ivec3& coord : wanted)
+		is_wanted[coord] = true;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for(auto& busy : m_busy)
+		busy.second = false;
+
+	// Finished chunks are not held by the caller until they are popped, so they come back in wanted while still wanted
+	std::map<glm::ivec3, bool, chunk_less> ready;
+	for(auto it = m_ready.begin(); it != m_ready.end();)
+	{
+		if(is_wanted.find(it->coord) == is_wanted.end())
+			it = m_ready.erase(it);
+		else
+			ready[(it++)->coord] = true;
+	}
+
+	m_pending.clear();
+	for(const auto& o : order)
+	{
+		auto busy = m_busy.find(o.second);
+		if(busy != m_busy.end())
+			busy->second = true; // Still wanted; keep its result
+		else if(ready.find(o.second) == ready.end())
+			m_pending.push_back(o.second);
+	}
+
+	m_cv.notify_all();
+}
+
+bool chunkstreamer::pop_ready(ready_t& result)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_ready.empty())
+		return false;
+
+	result = m_ready.front();
+	m_ready.pop_front();
+	return true;
+}
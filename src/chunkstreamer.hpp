@@ -0,0 +1,76 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+#include "nebulagen.hpp"
+
+/* Orders chunk coordinates, to key maps by chunk */
+struct chunk_less
+{
+	bool operator()(const glm::ivec3& a, const glm::ivec3& b) const
+	{
+		if(a.x != b.x)
+			return a.x < b.x;
+		if(a.y != b.y)
+			return a.y < b.y;
+		return a.z < b.z;
+	}
+};
+
+/*
+ * Generates chunks of an endless nebula on background threads, nearest to the camera first.
+ *
+ * Every frame, the scene passes the chunks it wants and the camera; chunks that are no longer wanted are dropped
+ * before they are started, and the remaining ones are generated in order of priority. Finished chunks are collected
+ * with pop_ready, on the thread that uploads them.
+ */
+class chunkstreamer
+{
+public:
+	typedef std::shared_ptr<const nebulagen::chunk_t> chunk_ptr;
+
+	struct ready_t
+	{
+		glm::ivec3 coord;
+		chunk_ptr chunk;
+	};
+
+private:
+	nebulagen m_gen;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::vector<glm::ivec3> m_pending; // Lowest priority first, so that the next chunk is taken from the back
+	std::map<glm::ivec3, bool, chunk_less> m_busy; // Chunks being generated; false once they are no longer wanted
+	std::deque<ready_t> m_ready;
+	bool m_stop;
+
+	std::vector<std::thread> m_threads;
+
+	chunkstreamer(const chunkstreamer&) = delete;
+	chunkstreamer& operator=(const chunkstreamer&) = delete;
+
+	void run();
+
+public:
+	/* Priority of a chunk; lower is sooner. Chunks behind the camera count as twice as far away */
+	static GLfloat priority(const glm::ivec3& coord, const glm::vec3& camera, const glm::vec3& direction);
+
+	chunkstreamer(const int seed, const size_t thread_count);
+	~chunkstreamer();
+
+	/*
+	 * Replaces the chunks to generate; wanted excludes the chunks the caller already holds. Chunks being generated or
+	 * waiting for pop_ready are kept if still wanted and not generated again, the others are dropped.
+	 */
+	void request(const std::vector<glm::ivec3>& wanted, const glm::vec3& camera, const glm::vec3& direction);
+
+	/* Takes a finished chunk, if any */
+	bool pop_ready(ready_t& result);
+};
@@ -1,17 +1,34 @@
 #pragma once
 
 #include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
 #include <boost/program_options.hpp>
+#include <boost/optional.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include "gl/glfwcontext.hpp"
 #include "gl/glutcontext.hpp"
+#ifdef NEBULA_EGL
+#include "gl/eglcontext.hpp"
+#endif
+#include "gl/camerapath.hpp"
 
 #include "util/cache.hpp"
+#include "util/image.hpp"
+#include "util/taskgraph.hpp"
+#include "util/trace.hpp"
 
 #include "nebulagen.hpp"
+#include "nebulashard.hpp"
 #include "volumelighting.hpp"
+#include "volumeraycaster.hpp"
 #include "volumeparticletransform.hpp"
 #include "particlelighting.hpp"
+#include "particlesplatter.hpp"
 
 #include "simplescene.hpp"
 #include "nebulascene.hpp"
@@ -26,7 +43,8 @@ class cli
 	enum class context
 	{
 		CONTEXT_GLUT,
-		CONTEXT_GLFW
+		CONTEXT_GLFW,
+		CONTEXT_EGL
 	};
 
 	enum class scene
@@ -41,24 +59,159 @@ class cli
 		scene s;
 
 		int seed = 4821903;
+		std::string trace_file; // Written on exit, if not empty
+
+		std::string frame_stats_file; // Written when the window closes, if not empty
+		double stats_interval = 5.0; // Seconds
+
+		boost::optional<camera_path> path; // Flythrough benchmark, if set
+		size_t frames = 600; // Of a flythrough or an offscreen run
+
+		size_t width = 1280, height = 720; // Offscreen and CPU rendering only
+		std::string dump;
+
+		std::string cpu_render; // Image rendered on the CPU, if not empty
+		camera_t camera{glm::vec3(-1.0f, 0.0f, -1.0f), glm::vec2(0.0f, 0.0f)}; // Of a CPU still; where the scenes start
+
+		bool bake = false;
+		std::vector<int> seeds;
+		size_t memory_budget = 4096; // MiB
+
+		size_t shard = 0, shard_count = 0; // Shard to generate, if shard_count > 0
+		size_t merge_count = 0; // Shards to merge, if > 0
+
+		bool out_of_core = false;
+		size_t brick_cache = 512; // MiB
+
+		bool infinite = false;
+		nebulascene::stream_options stream;
+
+		nebulascene::raycast_options raycast;
 	};
 
+	/* Parses a resolution "WxH" */
+	static bool parse_size(const std::string& str, size_t& width, size_t& height)
+	{
+		std::istringstream is(str);
+		char x;
+		return (is >> width >> x) && x == 'x' && (is >> height) && is.eof() && width > 0 && height > 0;
+	}
+
+	/* Parses a camera "x,y,z,yaw,pitch" */
+	static bool parse_camera(const std::string& str, camera_t& camera)
+	{
+		std::istringstream is(str);
+		char c[4];
+		glm::vec3& p = camera.position;
+		glm::vec2& r = camera.rotation;
+		return (is >> p.x >> c[0] >> p.y >> c[1] >> p.z >> c[2] >> r.x >> c[3] >> r.y) && is.eof() && std::count(c, c + 4, ',') == 4;
+	}
+
+	/* Parses a shard specification "i/n" with i < n */
+	static bool parse_shard(const std::string& str, size_t& shard, size_t& shard_count)
+	{
+		std::istringstream is(str);
+		char slash;
+		return (is >> shard >> slash) && slash == '/' && (is >> shard_count) && is.eof() && shard < shard_count && shard_count <= nebulagen::X;
+	}
+
+	/* Parses a list of seeds and seed ranges, such as "1-64" or "3,7,10-12" */
+	static bool parse_seeds(const std::string& str, std::vector<int>& seeds)
+	{
+		std::istringstream ss(str);
+		std::string item;
+		while(std::getline(ss, item, ','))
+		{
+			int first, last;
+			char dash;
+			std::istringstream is(item);
+
+			if(!(is >> first))
+				return false;
+
+			if(is >> dash)
+			{
+				if(dash != '-' || !(is >> last) || last < first)
+					return false;
+			}
+			else
+				last = first;
+
+			for(int seed = first; seed <= last; ++seed)
+				seeds.push_back(seed);
+		}
+
+		return !seeds.empty();
+	}
+
 	static int interpret(options& opt, int argc, char** argv)
 	{
-		std::string context_str, scene_str;
+		std::string context_str, scene_str, seeds_str, shard_str, path_str, size_str, camera_str;
+		size_t upload_budget_kib = opt.stream.upload_budget / 1024;
 
 		boost::program_options::options_description o_general("General options");
 		o_general.add_options()
 				("help,h", "display this message")
-				("context,c", boost::program_options::value(&context_str), "{glut, glfw} GL context library (defaults to glfw)")
+				("context,c", boost::program_options::value(&context_str), "{glut, glfw, egl} GL context library; egl renders offscreen without a display (defaults to glfw)")
 				("scene,s", boost::program_options::value(&scene_str), "{volume, particle} render method (defaults to particle)")
-				("seed,i", boost::program_options::value(&opt.seed), "any number (defaults to 4821903)");
+				("seed,i", boost::program_options::value(&opt.seed), "any number (defaults to 4821903)")
+				("trace", boost::program_options::value(&opt.trace_file), "write a Chrome trace-event JSON of the stages and frames to this file on exit, for chrome://tracing or ui.perfetto.dev")
+				("frame-stats", boost::program_options::value(&opt.frame_stats_file), "write the timings of the last frames to this file when the window closes; JSON summaries for .json, one row per frame otherwise")
+				("stats-interval", boost::program_options::value(&opt.stats_interval), "seconds between frame time summaries on stderr, 0 to disable them (defaults to 5)");
+
+		boost::program_options::options_description o_bake("Bake options");
+		o_bake.add_options()
+				("bake,b", "generate the caches of all stages without opening a window")
+				("seeds", boost::program_options::value(&seeds_str), "seeds to bake, as a list of numbers and ranges, e.g. 1-64 or 3,7,10-12 (defaults to --seed)")
+				("memory-budget", boost::program_options::value(&opt.memory_budget), "MiB of memory for seeds that are baked concurrently (defaults to 4096)");
+
+		boost::program_options::options_description o_shard("Shard options (volume scene)");
+		o_shard.add_options()
+				("shard", boost::program_options::value(&shard_str), "i/n, generate and light slab i of n of the volume and write it to shard_<seed>_<i>_<n>.slab; the dust of the slab's shadow halo, which spans the slab and the x of every star, is held in memory")
+				("merge", boost::program_options::value(&opt.merge_count), "n, combine the n slabs of --seed into the lit volume cache");
+
+		boost::program_options::options_description o_bricks("Out-of-core options (volume scene)");
+		o_bricks.add_options()
+				("out-of-core", "generate the dust into volume_<seed>.bricks and, with --merge, write the lit volume to volume_lighted_<seed>.bricks, both without holding the volume in memory; with --shard read the dust from volume_<seed>.bricks instead of generating it, but still hold the shadow halo of the slab in memory (see --shard)")
+				("brick-cache", boost::program_options::value(&opt.brick_cache), "MiB of bricks cached in memory (defaults to 512)");
+
+		boost::program_options::options_description o_stream("Streaming options (volume scene)");
+		o_stream.add_options()
+				("infinite", "fly through an endless nebula, generated in chunks around the camera")
+				("stream-radius", boost::program_options::value(&opt.stream.radius), "distance in chunks up to which chunks are generated (defaults to 2.5)")
+				("upload-budget", boost::program_options::value(&upload_budget_kib), "KiB of chunk data uploaded to the GPU per frame (defaults to 512)")
+				("stream-threads", boost::program_options::value(&opt.stream.threads), "threads generating chunks (defaults to all but one)");
+
+		boost::program_options::options_description o_raycast("Raycasting options (volume scene)");
+		o_raycast.add_options()
+				("raycast-scale", boost::program_options::value(&opt.raycast.scale), "1, 2 or 4, raycast the volume at this fraction of the resolution per axis and upsample it, keeping the edges of the volume sharp (defaults to 1)")
+				("raycast-budget", boost::program_options::value(&opt.raycast.budget), "milliseconds of GPU time for the raycast per frame; the scale then changes between 1 and 4 to stay within it, starting at --raycast-scale (defaults to 0, a fixed scale)")
+				("raycast-thin-stride", boost::program_options::value(&opt.raycast.thin_stride), "steps per sample where the dust is thin, at least 1; 1 samples every step and matches --cpu-render (defaults to 4)");
+
+		boost::program_options::options_description o_flythrough("Benchmark options");
+		o_flythrough.add_options()
+				("camera-path", boost::program_options::value(&path_str), "fly along the keyframes in this file without vsync, write the frame timings and exit; lines hold time, x, y, z, yaw and pitch")
+				("frames", boost::program_options::value(&opt.frames), "frames of the flythrough, spread evenly over the path, or of an egl run (defaults to 600)")
+				("size", boost::program_options::value(&size_str), "WxH, resolution of an egl run or a CPU render (defaults to 1280x720)")
+				("dump", boost::program_options::value(&opt.dump), "write every frame of an egl run to this path, with the frame number inserted before the extension; PNG for .png, PPM otherwise");
 
 		boost::program_options::variables_map vm;
 		boost::program_options::positional_options_description pos;
 
+		boost::program_options::options_description o_cpu("CPU rendering options");
+		o_cpu.add_options()
+				("cpu-render", boost::program_options::value(&opt.cpu_render), "render the scene on the CPU, raycasting the volume or splatting the particles, and write the image to this file, PNG for .png, PPM otherwise; with --camera-path one image per frame, numbered as for --dump")
+				("camera", boost::program_options::value(&camera_str), "x,y,z,yaw,pitch, camera of a CPU still (defaults to -1,0,-1,0,0)");
+
 		boost::program_options::options_description options("Allowed options");
 		options.add(o_general);
+		options.add(o_bake);
+		options.add(o_shard);
+		options.add(o_bricks);
+		options.add(o_stream);
+		options.add(o_raycast);
+		options.add(o_flythrough);
+		options.add(o_cpu);
 
 		try
 		{
@@ -84,7 +237,17 @@ class cli
 					<< "Volumetric Particle Clouds and Raycasting in OpenGL and C++11. [https://github.com/Wassasin/nebula]" << std::endl
 					<< "Usage: ./nebula [options]" << std::endl
 					<< std::endl
-					<< o_general;
+					<< o_general
+					<< o_bake
+					<< o_shard
+					<< o_bricks
+					<< o_stream
+					<< o_raycast
+					<< o_flythrough
+					<< o_cpu
+					<< std::endl
+					<< "Sharding on one machine, with four processes:" << std::endl
+					<< "  for i in 0 1 2 3; do ./nebula --shard $i/4 & done; wait; ./nebula --merge 4" << std::endl;
 
 			return 1;
 		}
@@ -93,6 +256,10 @@ class cli
 			opt.c = context::CONTEXT_GLFW;
 		else if(context_str == "glut")
 			opt.c = context::CONTEXT_GLUT;
+#ifdef NEBULA_EGL
+		else if(context_str == "egl")
+			opt.c = context::CONTEXT_EGL;
+#endif
 		else
 		{
 			std::cerr << "Unrecognized context \"" << context_str << "\"" << std::endl;
@@ -109,66 +276,513 @@ class cli
 			return 1;
 		}
 
+		opt.bake = vm.count("bake");
+		opt.out_of_core = vm.count("out-of-core");
+
+		opt.infinite = vm.count("infinite");
+		opt.stream.seed = opt.seed;
+		opt.stream.upload_budget = upload_budget_kib * 1024;
+
+		if(opt.infinite && opt.s != scene::SCENE_VOLUME)
+		{
+			std::cerr << "--infinite requires --scene volume" << std::endl;
+			return 1;
+		}
+
+		if(opt.cpu_render != "" && opt.infinite)
+		{
+			std::cerr << "--cpu-render does not support --infinite" << std::endl;
+			return 1;
+		}
+
+		if(opt.raycast.scale != 1 && opt.raycast.scale != 2 && opt.raycast.scale != nebulascene::raycast_options::max_scale)
+		{
+			std::cerr << "--raycast-scale must be 1, 2 or " << nebulascene::raycast_options::max_scale << std::endl;
+			return 1;
+		}
+
+		if(opt.raycast.thin_stride < 1.0f)
+		{
+			std::cerr << "--raycast-thin-stride must be at least 1" << std::endl;
+			return 1;
+		}
+
+		if(opt.raycast.budget < 0.0)
+		{
+			std::cerr << "--raycast-budget must not be negative" << std::endl;
+			return 1;
+		}
+
+		if(camera_str != "" && !parse_camera(camera_str, opt.camera))
+		{
+			std::cerr << "Unrecognized camera \"" << camera_str << "\", expected x,y,z,yaw,pitch" << std::endl;
+			return 1;
+		}
+
+		if(opt.frames == 0)
+		{
+			std::cerr << "--frames must be at least 1" << std::endl;
+			return 1;
+		}
+
+		if(size_str != "" && !parse_size(size_str, opt.width, opt.height))
+		{
+			std::cerr << "Unrecognized size \"" << size_str << "\", expected WxH" << std::endl;
+			return 1;
+		}
+
+		if(opt.c != context::CONTEXT_EGL && opt.dump != "")
+		{
+			std::cerr << "--dump requires --context egl" << std::endl;
+			return 1;
+		}
+
+		if(opt.c != context::CONTEXT_EGL && opt.cpu_render == "" && size_str != "")
+		{
+			std::cerr << "--size requires --context egl or --cpu-render" << std::endl;
+			return 1;
+		}
+
+		if(path_str != "")
+		{
+			if(opt.c == context::CONTEXT_GLUT)
+			{
+				std::cerr << "--camera-path requires --context glfw or egl" << std::endl;
+				return 1;
+			}
+
+			try
+			{
+				opt.path = camera_path::load(path_str);
+			} catch(const std::runtime_error& e)
+			{
+				std::cerr << e.what() << std::endl;
+				return 1;
+			}
+
+			if(opt.frame_stats_file == "")
+				opt.frame_stats_file = "flythrough.csv";
+		}
+
+		if(seeds_str == "")
+			opt.seeds.push_back(opt.seed);
+		else if(!parse_seeds(seeds_str, opt.seeds))
+		{
+			std::cerr << "Unrecognized seeds \"" << seeds_str << "\"" << std::endl;
+			return 1;
+		}
+
+		if(shard_str != "" && !parse_shard(shard_str, opt.shard, opt.shard_count))
+		{
+			std::cerr << "Unrecognized shard \"" << shard_str << "\", expected i/n with i < n" << std::endl;
+			return 1;
+		}
+
+		if(vm.count("merge") && (opt.merge_count == 0 || opt.merge_count > nebulagen::X))
+		{
+			std::cerr << "Unrecognized shard count " << opt.merge_count << std::endl;
+			return 1;
+		}
+
 		return 0;
 	}
 
-	static nebulagen::nebula_t acquire_volume(const options& opt)
+	/* Inputs of the scenes, produced by the startup stages */
+	struct resources_t
+	{
+		std::shared_ptr<const nebulagen::nebula_t> volume, volume_lighted;
+		std::shared_ptr<particle_nebula_t> particles_instanced;
+		std::shared_ptr<const particle_nebula_t> particles;
+		std::shared_ptr<const nebulaparticlescene::textures_t> textures;
+		size_t volume_write = 0, volume_lighted_write = 0, particles_write = 0; // cache_writer tickets of their writes, 0 if none
+	};
+
+	/*
+	 * Adds the stages of one seed to a graph. Stages backed by an existing cache only load it and do not add their inputs;
+	 * stages without inputs wait for the stages given as after.
+	 */
+	class stage_builder
 	{
-		return cache<nebulagen::nebula_t>::acquire("volume.msgpack.gz", [&](){
-			nebulagen gen(opt.seed);
-			return gen.generate();
-		});
+		typedef std::vector<task_graph::task_id> ids_t;
+		typedef std::function<ids_t()> inputs_t;
+
+		task_graph& m_g;
+		const int m_seed;
+		resources_t& m_res;
+		const ids_t m_after;
+		boost::optional<task_graph::task_id> m_volume;
+
+		template<typename T>
+		task_graph::task_id add_cached(const std::string& name, const std::string& filename, std::shared_ptr<const T>& result, size_t& write, const std::function<T()>& generate, const inputs_t& inputs)
+		{
+			// The inputs of generate are not scheduled, so a cache that disappears before it is loaded cannot be regenerated
+			if(boost::filesystem::exists(filename))
+				return m_g.add("load " + filename, [&result, filename]() {
+					result = cache<T>::acquire(filename, [filename]() -> T {
+						throw std::runtime_error(filename + " disappeared before it was loaded");
+					});
+				}, m_after);
+
+			return m_g.add(name, [&result, &write, filename, generate]() {
+				result = cache<T>::acquire(filename, generate, block_codec_options(), &write);
+			}, inputs());
+		}
+
+		ids_t volume()
+		{
+			if(!m_volume)
+			{
+				const int seed = m_seed;
+				m_volume = add_cached<nebulagen::nebula_t>("generate volume", cache_name("volume"), m_res.volume, m_res.volume_write, [seed]() {
+					nebulagen gen(seed);
+					return gen.generate();
+				}, [this]() { return m_after; });
+			}
+
+			return ids_t(1, *m_volume);
+		}
+
+		ids_t instanced_particles()
+		{
+			resources_t& res = m_res;
+			const int seed = m_seed;
+			return ids_t(1, m_g.add("instance particles", [&res, seed]() {
+				res.particles_instanced = std::make_shared<particle_nebula_t>(volume_to_particles(res.volume->dust, seed), res.volume->stars);
+			}, volume()));
+		}
+
+	public:
+		stage_builder(task_graph& g, const int seed, resources_t& res, const ids_t& after = ids_t())
+		: m_g(g)
+		, m_seed(seed)
+		, m_res(res)
+		, m_after(after)
+		, m_volume()
+		{}
+
+		std::string cache_name(const std::string& stage) const
+		{
+			return stage + "_" + std::to_string(m_seed) + ".msgpack.gz";
+		}
+
+		task_graph::task_id volume_lighted()
+		{
+			resources_t& res = m_res;
+			return add_cached<nebulagen::nebula_t>("light volume", cache_name("volume_lighted"), m_res.volume_lighted, m_res.volume_lighted_write, [&res]() {
+				nebulagen::nebula_t nebula = *res.volume; // Copy; the cached result is shared with the background writer
+				volumelighting<nebulagen::X, nebulagen::Y, nebulagen::Z, nebulagen::dust_t, nebulagen::light_t>::apply_lighting(nebula);
+				return nebula;
+			}, [this]() { return volume(); });
+		}
+
+		task_graph::task_id particles()
+		{
+			resources_t& res = m_res;
+			return add_cached<particle_nebula_t>("light particles", cache_name("particles"), m_res.particles, m_res.particles_write, [&res]() {
+				particle_nebula_t pnebula = std::move(*res.particles_instanced);
+				res.particles_instanced.reset();
+
+				particlelighting::apply_lighting(pnebula);
+				return pnebula;
+			}, [this]() { return instanced_particles(); });
+		}
+
+		/* Independent of the nebula; overlaps with generating it */
+		task_graph::task_id textures()
+		{
+			resources_t& res = m_res;
+			return m_g.add("load textures", [&res]() {
+				res.textures = std::make_shared<const nebulaparticlescene::textures_t>(nebulaparticlescene::load_textures());
+			}, m_after);
+		}
+	};
+
+	/* Rough peak memory of baking one seed: the dust, its lit copy and the copies held by the cache writer, plus the light volume */
+	static size_t seed_footprint()
+	{
+		return 4 * nebulagen::X * nebulagen::Y * nebulagen::Z * sizeof(nebulagen::dust_t)
+			+ nebulagen::X * nebulagen::Y * nebulagen::Z * sizeof(nebulagen::light_t);
+	}
+
+	/*
+	 * Generates all caches of every seed without opening a window. All seeds share one graph and thread pool;
+	 * seed i starts after seed i - lanes finished, where lanes is the number of seeds that fit in the memory budget.
+	 * A seed is only finished once the cache writer has written its results and let go of them. Existing caches are kept.
+	 */
+	static int bake(const options& opt)
+	{
+		const size_t lanes = std::max<size_t>(1, (opt.memory_budget << 20) / seed_footprint());
+		std::cerr << "Baking " << opt.seeds.size() << " seeds, " << lanes << " at a time" << std::endl;
+
+		std::vector<resources_t> res(opt.seeds.size());
+		std::vector<task_graph::task_id> done;
+
+		task_graph g;
+		for(size_t i = 0; i < opt.seeds.size(); ++i)
+		{
+			std::vector<task_graph::task_id> after;
+			if(i >= lanes)
+				after.push_back(done[i - lanes]);
+
+			stage_builder b(g, opt.seeds[i], res[i], after);
+
+			// Caches that exist are not loaded just to be dropped; their inputs are only loaded for the missing ones
+			std::vector<task_graph::task_id> outputs;
+			if(!boost::filesystem::exists(b.cache_name("volume_lighted")))
+				outputs.push_back(b.volume_lighted());
+			if(!boost::filesystem::exists(b.cache_name("particles")))
+				outputs.push_back(b.particles());
+
+			const int seed = opt.seeds[i];
+			resources_t& r = res[i];
+			done.push_back(g.add("finish seed " + std::to_string(seed), [&r, seed]() {
+				// The writer runs its queue in order, so waiting for the last write of this seed covers all of them
+				const size_t last_write = std::max(r.volume_write, std::max(r.volume_lighted_write, r.particles_write));
+				r = resources_t();
+
+				if(last_write > 0)
+					cache_writer::instance().wait(last_write);
+				std::cerr << "Baked seed " << seed << std::endl;
+			}, outputs));
+		}
+
+		g.run();
+		cache_writer::instance().wait();
+		return 0;
+	}
+
+	static int shard(const options& opt)
+	{
+		if(opt.out_of_core)
+		{
+			const std::string filename = "volume_" + std::to_string(opt.seed) + ".bricks";
+			if(!boost::filesystem::exists(filename))
+			{
+				std::cerr << "Missing " << filename << ", generate it with --out-of-core first" << std::endl;
+				return 1;
+			}
+
+			nebulagen::dust_store_t store(filename, opt.brick_cache << 20);
+			nebulashard::generate_shard(opt.seed, opt.shard, opt.shard_count, store);
+			return 0;
+		}
+
+		nebulashard::generate_shard(opt.seed, opt.shard, opt.shard_count);
+		return 0;
+	}
+
+	/* Stores the merged shards as the lit volume cache, where the volume scene picks it up; an older cache is replaced */
+	static int merge(const options& opt)
+	{
+		const int seed = opt.seed;
+		const size_t n = opt.merge_count;
+
+		if(opt.out_of_core)
+		{
+			nebulagen::dust_store_t store("volume_lighted_" + std::to_string(seed) + ".bricks", opt.brick_cache << 20);
+			nebulashard::merge(seed, n, store);
+			return 0;
+		}
+
+		const nebulagen::nebula_t nebula = nebulashard::merge(seed, n);
+		return cache<nebulagen::nebula_t>::write("volume_lighted_" + std::to_string(seed) + ".msgpack.gz", nebula) ? 0 : 1;
 	}
 
-	static nebulagen::nebula_t acquire_volume_lighted(const options& opt)
+	/* Generates the dust one slab of bricks at a time, straight into the brick file */
+	static int generate_out_of_core(const options& opt)
 	{
-		return cache<nebulagen::nebula_t>::acquire("volume_lighted.msgpack.gz", [&](){
-			nebulagen::nebula_t nebula = acquire_volume(opt);
-			volumelighting<nebulagen::X, nebulagen::Y, nebulagen::Z>::apply_lighting(nebula);
-			return nebula;
-		});
+		nebulagen::dust_store_t store("volume_" + std::to_string(opt.seed) + ".bricks", opt.brick_cache << 20);
+		nebulagen gen(opt.seed);
+		gen.generate(store, nebulagen::dust_store_t::brick_size);
+
+		std::cerr << store.allocated_bricks() << " of " << nebulagen::dust_store_t::brick_count << " bricks hold dust" << std::endl;
+		return 0;
 	}
 
-	static particle_nebula_t acquire_particles(const options& opt)
+	/* Renders every frame of the camera path, or a single still, with draw and writes the images */
+	static int render_cpu_frames(const options& opt, const std::function<void(rgb_image&, const camera_t&)>& draw)
 	{
-		return cache<particle_nebula_t>::acquire("particles.msgpack.gz", [&](){
-			particle_nebula_t pnebula;
+		const size_t frames = opt.path ? opt.frames : 1;
+
+		frame_stats stats;
+		stats.set_capacity(frames);
 
+		rgb_image image(opt.width, opt.height);
+		for(size_t i = 0; i < frames; ++i)
+		{
+			typedef std::chrono::steady_clock clock;
+			const clock::time_point begin = clock::now();
+
+			draw(image, opt.path ? opt.path->at_frame(i, frames) : opt.camera);
+
+			const clock::time_point draw_end = clock::now();
+
+			const std::string filename = opt.path ? numbered_filename(opt.cpu_render, i) : opt.cpu_render;
+			if(!image.write(filename))
 			{
-				nebulagen::nebula_t nebula = acquire_volume(opt);
-				pnebula = particle_nebula_t(volume_to_particles(nebula.dust, opt.seed), nebula.stars);
+				std::cerr << "Could not write " << filename << std::endl;
+				return 1;
 			}
 
-			particlelighting::apply_lighting(pnebula);
-			return pnebula;
-		});
+			const double draw_time = std::chrono::duration<double>(draw_end - begin).count();
+			stats.add({0.0, 0.0, draw_time, 0.0, std::chrono::duration<double>(clock::now() - begin).count()});
+			std::cerr << "Wrote " << filename << ", rendered in " << draw_time << "s" << std::endl;
+		}
+
+		if(frames > 1)
+			stats.report(std::cerr, stats.size());
+
+		if(!opt.frame_stats_file.empty() && !stats.write(opt.frame_stats_file))
+		{
+			std::cerr << "Could not write " << opt.frame_stats_file << std::endl;
+			return 1;
+		}
+
+		return 0;
+	}
+
+	/* Renders the scene without GL: raycasts the lit volume, or splats the particles */
+	static int render_cpu(const options& opt)
+	{
+		resources_t res;
+		{
+			task_graph g;
+			stage_builder b(g, opt.seed, res);
+
+			switch(opt.s)
+			{
+			case scene::SCENE_VOLUME:
+				b.volume_lighted();
+				break;
+			case scene::SCENE_PARTICLE:
+				b.particles();
+				b.textures();
+				break;
+			}
+
+			g.run();
+		}
+
+		res.volume.reset();
+		res.particles_instanced.reset();
+
+		// As the scenes place and project the nebula
+		const glm::vec3 model(-0.5f, -0.5f, -0.5f);
+		const GLfloat aspect = (GLfloat)opt.width/(GLfloat)opt.height;
+
+		switch(opt.s)
+		{
+		case scene::SCENE_VOLUME:
+		{
+			std::cerr << "Building the raycaster" << std::endl;
+			const volume_raycaster<nebulagen::X, nebulagen::Y, nebulagen::Z, nebulagen::dust_t> raycaster(*res.volume_lighted);
+			const glm::mat4 projection = glm::perspective(60.0f, aspect, 0.1f, 100.0f);
+
+			return render_cpu_frames(opt, [&](rgb_image& image, const camera_t& camera) {
+				raycaster.render(image, projection * camera.to_matrix() * glm::translate(glm::mat4(), model), camera.position - model);
+			});
+		}
+		case scene::SCENE_PARTICLE:
+		{
+			const particle_splatter splatter(*res.particles, res.textures->dust, res.textures->star);
+			res.textures.reset();
+			const glm::mat4 projection = glm::perspective(60.0f, aspect, 0.01f, 100.0f);
+
+			return render_cpu_frames(opt, [&](rgb_image& image, const camera_t& camera) {
+				splatter.render(image, projection, camera.to_matrix() * glm::translate(glm::mat4(), model));
+			});
+		}
+		default:
+			std::cerr << "Unknown scene (logic error)" << std::endl;
+			return 1;
+		}
+	}
+
+	static void configure(rendercontext&, const options&)
+	{}
+
+#ifdef NEBULA_EGL
+	static void configure(eglcontext& r, const options& opt)
+	{
+		r.set_size(opt.width, opt.height);
+		r.set_frames(opt.frames);
+		r.set_dump(opt.dump);
+	}
+#endif
+
+	/* Runs the render loop until the window closes or the flythrough ends, then exports the frame timings */
+	template<typename RENDERER>
+	static int run_renderer(RENDERER& r, const options& opt, int argc, char** argv)
+	{
+		configure(r, opt);
+		r.stats.set_report_interval(opt.stats_interval);
+		if(opt.path)
+			r.set_flythrough(*opt.path, opt.frames);
+
+		r.run(argc, argv);
+
+		if(opt.path || opt.c == context::CONTEXT_EGL)
+			r.stats.report(std::cerr, r.stats.size());
+
+		if(!opt.frame_stats_file.empty() && !r.stats.write(opt.frame_stats_file))
+		{
+			std::cerr << "Could not write " << opt.frame_stats_file << std::endl;
+			return 1;
+		}
+
+		return 0;
 	}
 
 	template<typename RENDERER>
 	static int render(const options& opt, int argc, char** argv)
 	{
+		if(opt.infinite)
+		{
+			RENDERER r;
+			nebulascene s(opt.stream, r, opt.raycast);
+			return run_renderer(r, opt, argc, argv);
+		}
+
+		resources_t res;
+		{
+			task_graph g;
+			stage_builder b(g, opt.seed, res);
+
+			switch(opt.s)
+			{
+			case scene::SCENE_VOLUME:
+				b.volume_lighted();
+				break;
+			case scene::SCENE_PARTICLE:
+				b.particles();
+				b.textures();
+				break;
+			}
+
+			g.run();
+		}
+
+		// Only the scene inputs are needed from here on
+		res.volume.reset();
+		res.particles_instanced.reset();
+
 		switch(opt.s)
 		{
 		case scene::SCENE_VOLUME:
 		{
-			auto volume_lighted = acquire_volume_lighted(opt);
-
 			RENDERER r;
-			nebulascene s(volume_lighted, r);
-			r.run(argc, argv);
-			return 0;
+			nebulascene s(*res.volume_lighted, r, opt.raycast);
+			return run_renderer(r, opt, argc, argv);
 		}
 		case scene::SCENE_PARTICLE:
 		{
-			auto particles = acquire_particles(opt);
-
 			RENDERER r;
 			r.add_cb(rcphase::draw, [&](rendercontext& r) {
 				gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			});
 
 			/*r.add_cb(rcphase::draw, [&](rendercontext& r) {
-				glm::vec3 model = particles.stars[0].pos + glm::vec3(-0.5f, -0.5f, -0.5f);
+				glm::vec3 model = res.particles->stars[0].pos + glm::vec3(-0.5f, -0.5f, -0.5f);
 
 				glm::mat4 projection = glm::perspective(60.0f, (GLfloat)r.size().first/(GLfloat)r.size().second, 0.1f, 100.0f);
 				glm::mat4 modelmat = glm::translate(glm::mat4(), model);
@@ -192,9 +806,8 @@ class cli
 				glPopMatrix();
 			});*/
 
-			nebulaparticlescene s(particles, r);
-			r.run(argc, argv);
-			return 0;
+			nebulaparticlescene s(*res.particles, res.textures, r);
+			return run_renderer(r, opt, argc, argv);
 		}
 		default:
 			std::cerr << "Unknown scene (logic error)" << std::endl;
@@ -204,12 +817,27 @@ class cli
 
 	static int act(const options& opt, int argc, char** argv)
 	{
+		if(opt.shard_count > 0)
+			return shard(opt);
+		if(opt.merge_count > 0)
+			return merge(opt);
+		if(opt.out_of_core)
+			return generate_out_of_core(opt);
+		if(opt.bake)
+			return bake(opt);
+		if(opt.cpu_render != "")
+			return render_cpu(opt);
+
 		switch(opt.c)
 		{
 		case context::CONTEXT_GLFW:
 			return render<glfwcontext>(opt, argc, argv);
 		case context::CONTEXT_GLUT:
 			return render<glutcontext>(opt, argc, argv);
+#ifdef NEBULA_EGL
+		case context::CONTEXT_EGL:
+			return render<eglcontext>(opt, argc, argv);
+#endif
 		default:
 			std::cerr << "Unknown context (logic error)" << std::endl;
 			return 1;
@@ -223,6 +851,23 @@ public:
 		int result = interpret(opt, argc, argv);
 		if(result != 0)
 			return result;
-		return act(opt, argc, argv);
+
+		if(opt.trace_file.empty())
+			return act(opt, argc, argv);
+
+		trace::start();
+		trace::name_thread("main");
+
+		result = act(opt, argc, argv);
+
+		cache_writer::instance().wait(); // Include the pending cache writes
+		if(!trace::write(opt.trace_file))
+		{
+			std::cerr << "Could not write " << opt.trace_file << std::endl;
+			return 1;
+		}
+
+		std::cerr << "Wrote trace to " << opt.trace_file << std::endl;
+		return result;
 	}
 };
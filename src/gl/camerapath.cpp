@@ -0,0 +1,100 @@
+#include "camerapath.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+static glm::vec3 catmull_rom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, const GLfloat t)
+{
+	const GLfloat t2 = t * t, t3 = t2 * t;
+	return 0.5f * (
+		2.0f * p1 +
+		(p2 - p0) * t +
+		(2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+		(3.0f * p1 - p0 - 3.0f * p2 + p3) * t3
+	);
+}
+
+camera_path::camera_path()
+: m_keyframes()
+{}
+
+camera_path camera_path::load(const std::string& filename)
+{
+	std::ifstream is(filename);
+	if(!is)
+		throw std::runtime_error("Could not open camera path " + filename);
+
+	return parse(is, filename);
+}
+
+camera_path camera_path::parse(std::istream& is, const std::string& filename)
+{
+	camera_path path;
+
+	std::string line;
+	for(size_t line_number = 1; std::getline(is, line); ++line_number)
+	{
+		const size_t comment = line.find('#');
+		if(comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream ls(line);
+		keyframe_t k;
+		if(!(ls >> k.time))
+			continue; // Blank line
+
+		glm::vec3& p = k.camera.position;
+		glm::vec2& r = k.camera.rotation;
+		std::string rest;
+		if(!(ls >> p.x >> p.y >> p.z >> r.x >> r.y) || (ls >> rest))
+			throw std::runtime_error(filename + ":" + std::to_string(line_number) + ": expected time, x, y, z, yaw and pitch");
+
+		if(!path.m_keyframes.empty() && k.time <= path.m_keyframes.back().time)
+			throw std::runtime_error(filename + ":" + std::to_string(line_number) + ": keyframe times must increase");
+
+		path.m_keyframes.push_back(k);
+	}
+
+	if(path.m_keyframes.empty())
+		throw std::runtime_error(filename + " has no keyframes");
+
+	return path;
+}
+
+GLfloat camera_path::duration() const
+{
+	return m_keyframes.back().time - m_keyframes.front().time;
+}
+
+camera_t camera_path::at(const GLfloat t) const
+{
+	const auto next = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), t, [](const GLfloat t, const keyframe_t& k) {
+		return t < k.time;
+	});
+
+	if(next == m_keyframes.begin())
+		return m_keyframes.front().camera;
+	if(next == m_keyframes.end())
+		return m_keyframes.back().camera;
+
+	// Segment [i1, i2], with the neighbouring keyframes clamped at the ends
+	const size_t i2 = next - m_keyframes.begin(), i1 = i2 - 1;
+	const size_t i0 = i1 > 0 ? i1 - 1 : i1, i3 = std::min(i2 + 1, m_keyframes.size() - 1);
+
+	const keyframe_t& k1 = m_keyframes[i1];
+	const keyframe_t& k2 = m_keyframes[i2];
+	const GLfloat s = (t - k1.time) / (k2.time - k1.time);
+
+	camera_t c;
+	c.position = catmull_rom(m_keyframes[i0].camera.position, k1.camera.position, k2.camera.position, m_keyframes[i3].camera.position, s);
+	c.rotation = glm::mix(k1.camera.rotation, k2.camera.rotation, s);
+	return c;
+}
+
+camera_t camera_path::at_frame(const size_t i, const size_t n) const
+{
+	const GLfloat f = n > 1 ? (GLfloat)i / (GLfloat)(n - 1) : 0.0f;
+	return at(m_keyframes.front().time + f * duration());
+}
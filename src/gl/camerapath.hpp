@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+
+#include "rendercontext.hpp"
+
+/*
+ * Keyframed camera flight, read from a text file with one keyframe per line:
+ *
+ *   # time  position x y z  rotation yaw pitch
+ *   0.0     -1.0 0.0 -1.0   0.0 0.0
+ *   5.0      0.5 0.5  0.5   0.8 0.1
+ *
+ * Positions follow a Catmull-Rom spline through the keyframes, rotations are interpolated linearly.
+ */
+class camera_path
+{
+	struct keyframe_t
+	{
+		GLfloat time;
+		camera_t camera;
+	};
+
+	std::vector<keyframe_t> m_keyframes; // Ordered by time
+
+public:
+	camera_path();
+
+	/* Throws std::runtime_error naming the offending line */
+	static camera_path load(const std::string& filename);
+	static camera_path parse(std::istream& is, const std::string& filename);
+
+	GLfloat duration() const;
+
+	/* Camera at time t, clamped to the path */
+	camera_t at(const GLfloat t) const;
+
+	/* Camera of frame i of n, spread evenly over the path */
+	camera_t at_frame(const size_t i, const size_t n) const;
+};
@@ -0,0 +1,182 @@
+#include "eglcontext.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "../util/image.hpp"
+#include "../util/scope_guard.hpp"
+#include "../util/trace.hpp"
+
+/* Mesa's surfaceless platform needs neither a display server nor a DRM device; falls back to the default display */
+static EGLDisplay open_display()
+{
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if(extensions && std::strstr(extensions, "EGL_MESA_platform_surfaceless"))
+	{
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if(get_platform_display)
+			return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+eglcontext::eglcontext()
+: rendercontext()
+, m_frames(600)
+, m_dump()
+{
+	m_size = std::make_pair(1280, 720);
+	stats.set_capacity(m_frames);
+}
+
+void eglcontext::set_size(const size_t width, const size_t height)
+{
+	m_size = std::make_pair(width, height);
+}
+
+void eglcontext::set_frames(const size_t frames)
+{
+	m_frames = frames;
+	stats.set_capacity(frames);
+}
+
+void eglcontext::set_dump(const std::string& path)
+{
+	m_dump = path;
+}
+
+void eglcontext::dump_frame(const size_t i) const
+{
+	trace::zone zone("dump frame");
+
+	rgb_image image(m_size.first, m_size.second);
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, image.data.data());
+	image.flip_vertical(); // GL rows start at the bottom
+
+	const std::string filename = numbered_filename(m_dump, i);
+	if(!image.write(filename))
+		throw std::runtime_error("Could not write " + filename);
+}
+
+void eglcontext::run(int, char**)
+{
+	EGLDisplay display = open_display();
+
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+		throw std::runtime_error("Failed to initialize EGL");
+
+	scope_guard display_guard([display]() { eglTerminate(display); });
+
+	// The scenes use the compatibility profile
+	if(!eglBindAPI(EGL_OPENGL_API))
+		throw std::runtime_error("EGL has no desktop OpenGL");
+
+	const EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint config_count = 0;
+	if(!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || config_count == 0)
+		throw std::runtime_error("No EGL config for an offscreen RGBA8 framebuffer with depth");
+
+	// A pbuffer rather than no surface at all: the scenes bind framebuffer 0 when they are done with their own
+	const EGLint surface_attributes[] = {
+		EGL_WIDTH, (EGLint)m_size.first,
+		EGL_HEIGHT, (EGLint)m_size.second,
+		EGL_NONE
+	};
+
+	EGLSurface surface = eglCreatePbufferSurface(display, config, surface_attributes);
+	if(surface == EGL_NO_SURFACE)
+		throw std::runtime_error("Failed to create a " + std::to_string(m_size.first) + "x" + std::to_string(m_size.second) + " pbuffer");
+
+	scope_guard surface_guard([display, surface]() { eglDestroySurface(display, surface); });
+
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+	if(context == EGL_NO_CONTEXT)
+		throw std::runtime_error("Failed to create an EGL context");
+
+	scope_guard context_guard([display, context]() {
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(display, context);
+	});
+
+	if(!eglMakeCurrent(display, surface, surface, context))
+		throw std::runtime_error("Failed to make the EGL context current");
+
+	std::cerr << "Rendering offscreen on " << glGetString(GL_RENDERER) << " (" << glGetString(GL_VERSION) << ")" << std::endl;
+
+	// GLEW without EGL support loads the GL functions but then fails to find a GLX display
+	glewExperimental = true;
+	const GLenum glew_error = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	if(glew_error != GLEW_OK && glew_error != GLEW_ERROR_NO_GLX_DISPLAY)
+#else
+	if(glew_error != GLEW_OK)
+#endif
+		throw gl_error{"glewInit", "GLEW initialisation failed."};
+
+	glGetError(); // GLEW may leave an error behind
+	gpu.init();
+
+	gl::viewport(0, 0, (GLsizei)m_size.first, (GLsizei)m_size.second);
+
+	run_phase(rcphase::init);
+
+	typedef std::chrono::steady_clock clock;
+	const auto seconds = [](const clock::time_point a, const clock::time_point b) {
+		return std::chrono::duration<double>(b - a).count();
+	};
+
+	const size_t frames = flythrough() ? m_path_frames : m_frames;
+	for(size_t i = 0; i < frames; ++i)
+	{
+		trace::zone frame_zone("frame");
+		gpu.begin_frame(stats);
+
+		const clock::time_point begin = clock::now();
+		if(flythrough())
+			place_camera(i);
+
+		const clock::time_point input_end = clock::now();
+		run_phase(rcphase::update);
+
+		const clock::time_point update_end = clock::now();
+		run_phase(rcphase::draw);
+
+		const clock::time_point draw_end = clock::now();
+		{
+			trace::zone zone("finish");
+			glFinish();
+		}
+
+		const clock::time_point finish_end = clock::now();
+		stats.add({seconds(begin, input_end), seconds(input_end, update_end), seconds(update_end, draw_end), seconds(draw_end, finish_end), seconds(begin, finish_end)});
+
+		// Not part of the frame time
+		if(!m_dump.empty())
+			dump_frame(i);
+	}
+
+	gpu.finish(stats);
+
+	run_phase(rcphase::cleanup);
+	gpu.destroy();
+}
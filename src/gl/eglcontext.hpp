@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "gl.hpp"
+
+#include "rendercontext.hpp"
+
+/*
+ * Headless context: renders a fixed number of frames into an offscreen pbuffer, without a display server.
+ * Uses Mesa's surfaceless EGL platform where available, so that it runs on the software rasterizer (llvmpipe).
+ * Each frame ends with glFinish, which takes the place of the buffer swap in the frame timings.
+ */
+class eglcontext : public rendercontext
+{
+	size_t m_frames;
+	std::string m_dump; // Frames are written to this path with the frame number inserted before the extension; empty for none
+
+	void dump_frame(const size_t i) const;
+
+public:
+	eglcontext();
+
+	void set_size(const size_t width, const size_t height);
+
+	/* Frames to render; a flythrough sets its own frame count */
+	void set_frames(const size_t frames);
+
+	/* Writes every frame as PNG or PPM, depending on the extension of path */
+	void set_dump(const std::string& path);
+
+	void run(int argc, char** argv);
+};
@@ -91,6 +91,7 @@ namespace gl {
 
 	X(active_texture                , glActiveTexture          )
 	X(attach_shader                 , glAttachShader           )
+	X(begin_query                   , glBeginQuery             )
 	X(bind_attribute_location       , glBindAttribLocation     )
 	X(bind_buffer                   , glBindBuffer             )
 	X(bind_framebuffer              , glBindFramebuffer        )
@@ -108,6 +109,7 @@ namespace gl {
 	X(delete_buffers                , glDeleteBuffers          )
 	X(delete_framebuffers           , glDeleteFramebuffers     )
 	X(delete_program                , glDeleteProgram          )
+	X(delete_queries                , glDeleteQueries          )
 	X(delete_renderbuffers          , glDeleteRenderbuffers    )
 	X(delete_shader                 , glDeleteShader           )
 	X(delete_textures               , glDeleteTextures         )
@@ -117,15 +119,19 @@ namespace gl {
 	X(draw_elements                 , glDrawElements           )
 	X(enable                        , glEnable                 )
 	X(enable_vertex_attribute_array , glEnableVertexAttribArray)
+	X(end_query                     , glEndQuery               )
 	X(framebuffer_renderbuffer      , glFramebufferRenderbuffer)
 	X(framebuffer_texture_2d        , glFramebufferTexture2D   )
 	X(generate_buffers              , glGenBuffers             )
 	X(generate_framebuffers         , glGenFramebuffers        )
+	X(generate_queries              , glGenQueries             )
 	X(generate_renderbuffers        , glGenRenderbuffers       )
 	X(generate_textures             , glGenTextures            )
 	X(generate_vertex_arrays        , glGenVertexArrays        )
 	X(get_program_info_log          , glGetProgramInfoLog      )
 	X(get_program_iv                , glGetProgramiv           )
+	X(get_query_object_iv           , glGetQueryObjectiv       )
+	X(get_query_object_ui64v        , glGetQueryObjectui64v    )
 	X(get_shader_info_log           , glGetShaderInfoLog       )
 	X(get_shader_iv                 , glGetShaderiv            )
 	X(get_uniform_location          , glGetUniformLocation     )
@@ -137,6 +143,7 @@ namespace gl {
 	X(texture_image_3d              , glTexImage3D             )
 	X(texture_parameter_f           , glTexParameterf          )
 	X(texture_parameter_i           , glTexParameteri          )
+	X(texture_sub_image_3d          , glTexSubImage3D          )
 	X(uniform_1f                    , glUniform1f              )
 	X(uniform_1i                    , glUniform1i              )
 	X(uniform_1ui                   , glUniform1ui             )
@@ -9,6 +9,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "../util/scope_guard.hpp"
+#include "../util/trace.hpp"
 
 glfwcontext::glfwcontext()
 : rendercontext()
@@ -43,10 +44,11 @@ void glfwcontext::run(int, char**)
 	glfwSetWindowFocusCallback(window, &focus_callback);
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
 	glfwSetCursorPos(window, m_size.first/2, m_size.second/2);
-	glfwSwapInterval(1);
+	glfwSwapInterval(flythrough() ? 0 : 1); // Flythroughs measure the frame rate, so they are not capped at the refresh rate
 
 	glewExperimental = true; // Needed for core profile
 	gl::init();
+	gpu.init();
 
 	if(glGetError() == GL_INVALID_ENUM)
 		std::cerr << "Swallowing false GL_INVALID_ENUM" << std::endl;
@@ -54,49 +56,65 @@ void glfwcontext::run(int, char**)
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 
-	for(const callback_t& f : m_cbs[rcphase::init])
-		f(*this);
+	run_phase(rcphase::init);
 
 	double last_time = glfwGetTime();
+	size_t frame = 0;
 	do
 	{
-		double current_time = glfwGetTime();
-		float delta_time = current_time - last_time;
-		float fps = -1.0;
-		if(delta_time > (1.0f / 62.0f))
-			fps = 1.0f / delta_time;
+		trace::zone frame_zone("frame");
+		gpu.begin_frame(stats);
 
-		process_input(delta_time, window);
+		const double current_time = glfwGetTime();
+		const float delta_time = current_time - last_time;
 
-		double input_time = glfwGetTime();
+		{
+			trace::zone zone("input");
+			if(flythrough())
+				place_camera(frame);
+			else
+				process_input(delta_time, window);
+		}
 
-		for(const callback_t& f : m_cbs[rcphase::update])
-			f(*this);
+		const double input_time = glfwGetTime();
 
-		double update_time = glfwGetTime();
+		run_phase(rcphase::update);
 
-		for(const callback_t& f : m_cbs[rcphase::draw])
-			f(*this);
+		const double update_time = glfwGetTime();
 
-		double draw_time = glfwGetTime();
+		run_phase(rcphase::draw);
 
-		std::cout << fps << " FPS\t | "
-				  << (input_time - current_time) << " input\t | "
-				  << (update_time - input_time) << " update\t | "
-				  << (draw_time - input_time) << " draw" << std::endl;
+		const double draw_time = glfwGetTime();
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		{
+			trace::zone zone("swap");
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
+
+		const double swap_time = glfwGetTime();
+
+		stats.add({
+			input_time - current_time,
+			update_time - input_time,
+			draw_time - update_time,
+			swap_time - draw_time,
+			swap_time - current_time
+		});
 
 		last_time = current_time;
+		++frame;
 	}
 	while(
+		!(flythrough() && frame >= m_path_frames) &&
 		glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
 		glfwWindowShouldClose(window) == 0
 	);
 
-	for(const callback_t& f : m_cbs[rcphase::cleanup])
-		f(*this);
+	gpu.finish(stats);
+
+	run_phase(rcphase::cleanup);
+	gpu.destroy();
 }
 
 void glfwcontext::process_input(float delta, GLFWwindow* window)
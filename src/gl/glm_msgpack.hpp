@@ -4,6 +4,12 @@
 
 #include "../gl/gl.hpp"
 #include "glm_include.hpp"
+#include "../util/msgpack_blob.hpp"
+
+MSGPACK_BLOB_TYPE(glm::vec3, 4)
+MSGPACK_BLOB_TYPE(glm::vec4, 4)
+MSGPACK_BLOB_TYPE(glm::uvec3, 4)
+MSGPACK_BLOB_TYPE(glm::uvec4, 4)
 
 namespace msgpack {
 
@@ -110,4 +116,31 @@ namespace msgpack {
 		o.pack((GLfloat)x.w);
 		return o;
 	}
+
+	/* Arrays of vectors are packed as a single blob, see util/msgpack_blob.hpp */
+	inline std::vector<glm::vec3>& operator>>(object o, std::vector<glm::vec3>& v)
+	{
+		msgpack_blob::unpack_vector(o, v);
+		return v;
+	}
+
+	template <typename Stream>
+	inline packer<Stream>& operator<<(packer<Stream>& o, const std::vector<glm::vec3>& v)
+	{
+		msgpack_blob::pack_vector(o, v);
+		return o;
+	}
+
+	inline std::vector<glm::vec4>& operator>>(object o, std::vector<glm::vec4>& v)
+	{
+		msgpack_blob::unpack_vector(o, v);
+		return v;
+	}
+
+	template <typename Stream>
+	inline packer<Stream>& operator<<(packer<Stream>& o, const std::vector<glm::vec4>& v)
+	{
+		msgpack_blob::pack_vector(o, v);
+		return o;
+	}
 }
@@ -1,12 +1,14 @@
 #include "glutcontext.hpp"
 
 #include <iostream>
+#include <chrono>
 
 #include <GL/glew.h>
 #include <GL/glu.h>
 #include <GL/glut.h>
 
 #include "gl.hpp"
+#include "../util/trace.hpp"
 
 glutcontext* glutcontext::m_singleton;
 
@@ -28,24 +30,41 @@ void glutcontext::run(int argc, char** argv)
 
 	glewExperimental = true; // Needed for core profile
 	gl::init();
+	gpu.init();
 
-	for(const callback_t& f : m_cbs[rcphase::init])
-		f(*this);
+	run_phase(rcphase::init);
 
 	glutMainLoop();
 
-	for(const callback_t& f : m_cbs[rcphase::cleanup])
-		f(*this);
+	run_phase(rcphase::cleanup);
+	gpu.destroy();
 }
 
 void glutcontext::draw()
 {
-	for(const callback_t& f : m_singleton->m_cbs[rcphase::update])
-		f(*m_singleton);
+	typedef std::chrono::steady_clock clock;
+	const auto seconds = [](const clock::time_point a, const clock::time_point b) {
+		return std::chrono::duration<double>(b - a).count();
+	};
 
-	for(const callback_t& f : m_singleton->m_cbs[rcphase::draw])
-		f(*m_singleton);
+	trace::zone frame_zone("frame");
+	m_singleton->gpu.begin_frame(m_singleton->stats);
 
-	glutSwapBuffers();
+	const clock::time_point begin = clock::now();
+	m_singleton->run_phase(rcphase::update);
+
+	const clock::time_point update_end = clock::now();
+	m_singleton->run_phase(rcphase::draw);
+
+	const clock::time_point draw_end = clock::now();
+	{
+		trace::zone zone("swap");
+		glutSwapBuffers();
+	}
+
+	const clock::time_point swap_end = clock::now();
+
+	// GLUT handles input between frames
+	m_singleton->stats.add({0.0, seconds(begin, update_end), seconds(update_end, draw_end), seconds(draw_end, swap_end), seconds(begin, swap_end)});
 	glutPostRedisplay();
 }
@@ -0,0 +1,133 @@
+#include "gputimer.hpp"
+
+#include <iostream>
+#include <map>
+#include <chrono>
+
+gpu_timer::gpu_timer(const size_t latency)
+: m_latency(std::max<size_t>(latency, 1))
+, m_available(false)
+, m_active(false)
+, m_frames()
+, m_free()
+, m_dropped(0)
+{}
+
+void gpu_timer::init()
+{
+	m_available = GLEW_VERSION_3_3 || glewGetExtension("GL_ARB_timer_query");
+
+	if(!m_available)
+		std::cerr << "No timer query support, GPU pass timings are disabled" << std::endl;
+}
+
+bool gpu_timer::available() const
+{
+	return m_available;
+}
+
+size_t gpu_timer::dropped() const
+{
+	return m_dropped;
+}
+
+void gpu_timer::begin(const char* pass)
+{
+	if(m_frames.empty())
+		m_frames.emplace_back(); // Timed outside begin_frame
+
+	GLuint id;
+	if(m_free.empty())
+		gl::generate_queries(1, &id);
+	else
+	{
+		id = m_free.back();
+		m_free.pop_back();
+	}
+
+	gl::begin_query(GL_TIME_ELAPSED, id);
+	m_frames.back().push_back({pass, id, std::chrono::steady_clock::now()});
+	m_active = true;
+}
+
+void gpu_timer::end()
+{
+	gl::end_query(GL_TIME_ELAPSED);
+	m_active = false;
+}
+
+void gpu_timer::collect(frame_stats& stats)
+{
+	std::map<std::string, double> passes; // Passes may run several times per frame, e.g. once per chunk
+	bool complete = true;
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	for(const query_t& q : m_frames.front())
+	{
+		GLint ready = GL_FALSE;
+		gl::get_query_object_iv(q.id, GL_QUERY_RESULT_AVAILABLE, &ready);
+
+		GLuint64 ns = 0;
+		if(ready == GL_TRUE)
+			gl::get_query_object_ui64v(q.id, GL_QUERY_RESULT, &ns);
+
+		// A pass cannot take longer than the time since it was issued; llvmpipe reports garbage for its first query
+		const double seconds = ns * 1e-9;
+		if(ready == GL_TRUE && seconds <= std::chrono::duration<double>(now - q.begin).count())
+			passes[q.pass] += seconds;
+		else
+			complete = false;
+
+		m_free.push_back(q.id);
+	}
+
+	m_frames.pop_front();
+
+	// A partial sum would understate the pass
+	if(!complete)
+	{
+		++m_dropped;
+		return;
+	}
+
+	for(const auto& p : passes)
+		stats.add_gpu(p.first, p.second);
+}
+
+void gpu_timer::begin_frame(frame_stats& stats)
+{
+	if(!m_available)
+		return;
+
+	while(m_frames.size() >= m_latency)
+		collect(stats);
+
+	m_frames.emplace_back();
+}
+
+void gpu_timer::finish(frame_stats& stats)
+{
+	if(!m_available)
+		return;
+
+	glFinish();
+	while(!m_frames.empty())
+		collect(stats);
+}
+
+void gpu_timer::destroy()
+{
+	if(m_active)
+		end();
+
+	for(const std::vector<query_t>& f : m_frames)
+		for(const query_t& q : f)
+			m_free.push_back(q.id);
+
+	m_frames.clear();
+
+	if(!m_free.empty())
+		gl::delete_queries(m_free.size(), m_free.data());
+
+	m_free.clear();
+}
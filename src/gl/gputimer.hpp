@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+#include "gl.hpp"
+
+#include "../util/framestats.hpp"
+
+/*
+ * Measures the GPU time of render passes with GL_TIME_ELAPSED queries. Results are read back latency frames later,
+ * when the GPU is done with them, so that timing never stalls the pipeline; frames with results that are still not
+ * available then, or that are implausible, are dropped. Without timer query support all calls do nothing.
+ *
+ * Only one pass can be timed at a time; a scope inside another scope is not timed.
+ */
+class gpu_timer
+{
+	struct query_t
+	{
+		const char* pass;
+		GLuint id;
+		std::chrono::steady_clock::time_point begin; // CPU time the query was issued
+	};
+
+	size_t m_latency;
+	bool m_available;
+	bool m_active; // A query is running
+
+	std::deque<std::vector<query_t>> m_frames; // Queries per frame, oldest first; the back is the current frame
+	std::vector<GLuint> m_free;
+	size_t m_dropped;
+
+	gpu_timer(const gpu_timer&) = delete;
+	gpu_timer& operator=(const gpu_timer&) = delete;
+
+	void begin(const char* pass);
+	void end();
+
+	/* Reads the results of the oldest frame into stats, summed per pass, and recycles its queries */
+	void collect(frame_stats& stats);
+
+public:
+	class scope
+	{
+		gpu_timer& m_timer;
+		bool m_timing;
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+	public:
+		/* pass must outlive the results, which are read back a few frames later; use a literal */
+		scope(gpu_timer& timer, const char* pass)
+		: m_timer(timer)
+		, m_timing(timer.m_available && !timer.m_active)
+		{
+			if(m_timing)
+				m_timer.begin(pass);
+		}
+
+		~scope()
+		{
+			if(m_timing)
+				m_timer.end();
+		}
+	};
+
+	gpu_timer(const size_t latency = 3);
+
+	/* Checks for timer query support; needs a current context */
+	void init();
+
+	bool available() const;
+
+	/* Frames whose results were dropped because they were not ready in time or implausible */
+	size_t dropped() const;
+
+	/* Starts a frame, and passes the results that have become available to stats */
+	void begin_frame(frame_stats& stats);
+
+	/* Waits for the GPU and passes the results of all remaining frames to stats */
+	void finish(frame_stats& stats);
+
+	/* Deletes the queries; needs the context to still be current */
+	void destroy();
+};
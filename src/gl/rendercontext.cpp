@@ -1,8 +1,10 @@
 #include "rendercontext.hpp"
+#include "camerapath.hpp"
 
 #include <iostream>
 
 #include "gl.hpp"
+#include "../util/trace.hpp"
 
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -10,7 +12,11 @@
 rendercontext::rendercontext()
 : m_cbs()
 , m_size(600, 450)
+, m_path()
+, m_path_frames(0)
 , camera({glm::vec3(0.0f, 0.0f, 0.0f), glm::vec2(0.0f, 0.0f)})
+, stats()
+, gpu()
 {}
 
 const std::pair<size_t, size_t>& rendercontext::size() const
@@ -18,22 +24,51 @@ const std::pair<size_t, size_t>& rendercontext::size() const
 	return m_size;
 }
 
+void rendercontext::set_flythrough(const camera_path& path, const size_t frames)
+{
+	m_path = std::make_shared<const camera_path>(path);
+	m_path_frames = frames;
+	stats.set_capacity(frames); // Keep every frame for the report
+}
+
+bool rendercontext::flythrough() const
+{
+	return (bool)m_path;
+}
+
+void rendercontext::place_camera(const size_t i)
+{
+	camera = m_path->at_frame(i, m_path_frames);
+}
+
+void rendercontext::run_phase(rcphase p)
+{
+	static const char* names[] = {"init", "update", "draw", "cleanup"};
+	trace::zone zone(names[(size_t)p]);
+
+	for(const callback_t& f : m_cbs[p])
+		f(*this);
+}
+
 void rendercontext::add_cb(rcphase p, const callback_t &f)
 {
 	m_cbs[p].push_back(f);
 }
 
-glm::mat4 camera_t::to_matrix() const
+glm::vec3 camera_t::direction() const
 {
-	glm::vec3 direction(
+	return glm::vec3(
 		glm::cos(rotation.y) * glm::sin(rotation.x),
 		glm::sin(rotation.y),
 		glm::cos(rotation.y) * glm::cos(rotation.x)
 	);
+}
 
+glm::mat4 camera_t::to_matrix() const
+{
 	return glm::lookAt(
 		position,
-		position + direction,
+		position + direction(),
 		glm::vec3(0.0, 1.0, 0.0)
 	);
 }
@@ -2,9 +2,12 @@
 
 #include <list>
 #include <map>
+#include <memory>
 #include <functional>
 
 #include "glm_include.hpp"
+#include "gputimer.hpp"
+#include "../util/framestats.hpp"
 
 enum class rcphase {
 	init,
@@ -17,9 +20,12 @@ struct camera_t {
 	glm::vec3 position;
 	glm::vec2 rotation;
 
+	glm::vec3 direction() const;
 	glm::mat4 to_matrix() const;
 };
 
+class camera_path;
+
 class rendercontext
 {
 public:
@@ -29,14 +35,29 @@ protected:
 	std::map<rcphase, std::list<callback_t>> m_cbs;
 	std::pair<size_t, size_t> m_size;
 
+	std::shared_ptr<const camera_path> m_path; // Flythrough, if set
+	size_t m_path_frames;
+
 	rendercontext();
 
+	/* Moves the camera to frame i of the flythrough */
+	void place_camera(const size_t i);
+
+	/* Calls the callbacks of phase p, as one trace zone */
+	void run_phase(rcphase p);
+
 public:
 	camera_t camera;
+	frame_stats stats;
+	mutable gpu_timer gpu; // Timing passes does not change what is drawn, so passes with a const context may time themselves
 
 	void add_cb(rcphase p, const callback_t& f);
 	const std::pair<size_t, size_t>& size() const;
 
+	/* Flies the camera along path for a fixed number of frames instead of following the input, without vsync; run returns after the last frame */
+	void set_flythrough(const camera_path& path, const size_t frames);
+	bool flythrough() const;
+
 	rendercontext(rendercontext&) = delete;
 	void run(int argc, char** argv) = delete;
 };
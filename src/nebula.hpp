@@ -4,15 +4,19 @@
 #include <msgpack.hpp>
 
 #include "volume.hpp"
+#include "voxel.hpp"
 #include "star.hpp"
 #include "particle.hpp"
 
 #include "gl/glm_msgpack.hpp"
+#include "util/msgpackstream.hpp"
 
-template<size_t X, size_t Y, size_t Z>
+template<size_t X, size_t Y, size_t Z, typename D = glm::vec4>
 struct volume_nebula_t
 {
-	volume<glm::vec4, X, Y, Z> dust;
+	typedef D dust_t;
+
+	volume<D, X, Y, Z> dust;
 	std::vector<star_t> stars;
 
 	volume_nebula_t()
@@ -25,12 +29,21 @@ struct volume_nebula_t
 	, stars(_stars)
 	{}
 
-	volume_nebula_t(const volume<glm::vec4, X, Y, Z>& _dust, const std::vector<star_t>& _stars)
+	volume_nebula_t(const volume<D, X, Y, Z>& _dust, const std::vector<star_t>& _stars)
 	: dust(_dust)
 	, stars(_stars)
 	{}
 
 	MSGPACK_DEFINE(dust, stars)
+
+	void msgpack_stream_unpack(msgpack_stream& s)
+	{
+		if(s.read_array_header() != 2)
+			throw msgpack::type_error();
+
+		stream_unpack(s, dust);
+		stream_unpack(s, stars);
+	}
 };
 
 struct particle_nebula_t
@@ -54,4 +67,13 @@ struct particle_nebula_t
 	{}
 
 	MSGPACK_DEFINE(particles, stars)
+
+	void msgpack_stream_unpack(msgpack_stream& s)
+	{
+		if(s.read_array_header() != 2)
+			throw msgpack::type_error();
+
+		stream_unpack(s, particles);
+		stream_unpack(s, stars);
+	}
 };
@@ -2,11 +2,13 @@
 
 #include <iostream>
 #include <cstdint>
+#include <algorithm>
 
-#include "simplex.hpp"
 #include "gl/glm_opts.hpp"
+#include "volumeexpr.hpp"
+#include "util/trace.hpp"
 
-constexpr size_t nebulagen::SIZE;
+constexpr size_t nebulagen::SIZE, nebulagen::X, nebulagen::Y, nebulagen::Z, nebulagen::CHUNK;
 constexpr GLfloat nebulagen::fX, nebulagen::fY, nebulagen::fZ;
 
 static inline GLfloat exp_curve(const GLfloat x, const GLfloat cover, const GLfloat sharpness)
@@ -22,19 +24,23 @@ static inline GLfloat sine_point(const simplex& s, glm::vec3 pos, glm::vec3 peri
 	return glm::clamp(glm::sin(v * (GLfloat)M_PI), 0.0f, 1.0f);
 }
 
-void nebulagen::generate_cloud(const glm::vec3 fcenter, const GLfloat size, const GLfloat noise_mod, volume<GLfloat, X, Y, Z>& density_volume)
+template<size_t SX, size_t SY, size_t SZ>
+void nebulagen::generate_cloud(const glm::vec3 fcenter, const GLfloat size, const GLfloat noise_mod, sparse_volume<GLfloat, SX, SY, SZ>& density_volume, const size_t x_begin, const size_t x_end, const glm::vec3 origin) const
 {
-	simplex s(m_seed);
+	static constexpr GLfloat fX = SX, fY = SY, fZ = SZ;
+
+	const simplex& s = m_noise;
 
 	glm::vec3 fstart = fcenter - glm::vec3(0.5)*size;
 	glm::vec3 fend = fcenter + glm::vec3(0.5)*size;
 
-	glm::ivec3 start = iupcast(fstart, fX, fY, fZ);
-	glm::ivec3 end = iupcast(fend, fX, fY, fZ);
+	// Clouds may lie partly or entirely outside of the volume; end >= start keeps the ranges empty then
+	const glm::ivec3 start = glm::max(iupcast(fstart, fX, fY, fZ), glm::ivec3(0));
+	const glm::ivec3 end = glm::max(glm::min(iupcast(fend, fX, fY, fZ), glm::ivec3(SX, SY, SZ)), start);
 
-	for(size_t x = glm::max(start.x, 0); x < (size_t)glm::min((int)X, end.x); ++x)
-		for(size_t y = glm::max(start.y, 0); y < (size_t)glm::min((int)Y, end.y); ++y)
-			for(size_t z = glm::max(start.z, 0); z < (size_t)glm::min((int)Z, end.z); ++z)
+	for(size_t x = std::max<size_t>(start.x, x_begin); x < std::min<size_t>(end.x, x_end); ++x)
+		for(size_t y = start.y; y < (size_t)end.y; ++y)
+			for(size_t z = start.z; z < (size_t)end.z; ++z)
 			{
 				glm::uvec3 pos(x, y, z);
 				glm::vec3 fpos = downcast(pos, fX, fY, fZ);
@@ -47,7 +53,7 @@ void nebulagen::generate_cloud(const glm::vec3 fcenter, const GLfloat size, cons
 					glm::clamp(
 						(
 							(GLfloat) std::pow(orb.x * orb.y * orb.z, 2.0) +
-							s.octave_noise(5.0f, 0.6f, 1.0f, fpos + glm::vec3(noise_mod))
+							s.octave_noise(5.0f, 0.6f, 1.0f, origin + fpos + glm::vec3(noise_mod))
 							),
 						0.5f,
 						1.5f
@@ -60,6 +66,41 @@ void nebulagen::generate_cloud(const glm::vec3 fcenter, const GLfloat size, cons
 			}
 }
 
+/* Colors the dust by the mix of both densities, for the x-planes [x_begin, x_end); planes holds those planes, laid out as in volume */
+template<size_t SX, size_t SY, size_t SZ>
+static void draw_dust(nebulagen::dust_t* planes, const sparse_volume<GLfloat, SX, SY, SZ>& reflective_volume, const sparse_volume<GLfloat, SX, SY, SZ>& absorbant_volume, const size_t x_begin, const size_t x_end)
+{
+	typedef sparse_volume<GLfloat, SX, SY, SZ> density_t;
+
+	static const glm::vec3 brownish(downcast(glm::uvec3(255, 222, 150)));
+	static const glm::vec3 blackish(downcast(glm::uvec3(10, 1, 1)));
+
+	constexpr GLfloat division = 0.75;
+
+	// The volumes are const, so lookups in untouched bricks do not allocate them
+	const auto absorbant = voxels(absorbant_volume) * division;
+	const auto reflective = voxels(reflective_volume) * (1.0f - division);
+
+	const auto dust = rgba(
+		mix(constant(brownish), constant(blackish), ratio(absorbant, absorbant + reflective)),
+		clamp(voxels(absorbant_volume) + voxels(reflective_volume), 0.0f, 1.0f)
+	);
+
+	// Voxels outside of every cloud remain empty; only visit bricks that were touched by either volume
+	for(size_t i = 0; i < density_t::brick_count; ++i)
+	{
+		if(!reflective_volume.is_active(i) && !absorbant_volume.is_active(i))
+			continue;
+
+		glm::uvec3 begin = density_t::brick_origin(i), end = density_t::brick_end(i);
+		begin.x = std::max<size_t>(begin.x, x_begin);
+		end.x = std::min<size_t>(end.x, x_end);
+
+		if(begin.x < end.x)
+			evaluate_region<volume_ops::store_voxel, SY, SZ>(planes, x_begin, dust, begin, end);
+	}
+}
+
 std::vector<star_t> nebulagen::generate_stars()
 {
 	return {
@@ -69,59 +110,112 @@ std::vector<star_t> nebulagen::generate_stars()
 	};
 }
 
-volume<glm::vec4, nebulagen::X, nebulagen::Y, nebulagen::Z> nebulagen::generate_dust()
+void nebulagen::generate_dust(dust_t* planes, const size_t x_begin, const size_t x_end)
 {
-	simplex s(m_seed);
 	std::default_random_engine engine(m_seed+1);
 
-	static const glm::vec3 brownish(downcast(glm::uvec3(255, 222, 150)));
-	static const glm::vec3 blackish(downcast(glm::uvec3(10, 1, 1)));
-
 	std::cerr << "Seeding dust" << std::endl;
 
-	static std::uniform_real_distribution<GLfloat> antiedge_dist(0.2, 0.8);
-	static std::uniform_real_distribution<GLfloat> size_dist(0.5, 1.0);
-	static std::uniform_real_distribution<GLfloat> small_size_dist(0.2, 0.5);
+	// Not static; several seeds may be generated concurrently
+	std::uniform_real_distribution<GLfloat> antiedge_dist(0.2, 0.8);
+	std::uniform_real_distribution<GLfloat> size_dist(0.5, 1.0);
+	std::uniform_real_distribution<GLfloat> small_size_dist(0.2, 0.5);
 
-	volume<GLfloat, X, Y, Z> reflective_volume;
-	for(size_t i = 0; i < 20; ++i)
+	density_volume_t reflective_volume, absorbant_volume;
 	{
-		glm::vec3 fcenter(antiedge_dist(engine), antiedge_dist(engine), antiedge_dist(engine));
-		generate_cloud(fcenter, size_dist(engine), i, reflective_volume);
+		trace::zone zone("seed dust");
+
+		for(size_t i = 0; i < 20; ++i)
+		{
+			glm::vec3 fcenter(antiedge_dist(engine), antiedge_dist(engine), antiedge_dist(engine));
+			generate_cloud(fcenter, size_dist(engine), i, reflective_volume, x_begin, x_end);
+		}
+
+		for(size_t i = 0; i < 20; ++i)
+		{
+			glm::vec3 fcenter(antiedge_dist(engine), antiedge_dist(engine), antiedge_dist(engine));
+			generate_cloud(fcenter, small_size_dist(engine), i+20, absorbant_volume, x_begin, x_end);
+		}
 	}
 
-	volume<GLfloat, X, Y, Z> absorbant_volume;
-	for(size_t i = 0; i < 20; ++i)
+	std::cerr << "Drawing dust" << std::endl;
+
 	{
-		glm::vec3 fcenter(antiedge_dist(engine), antiedge_dist(engine), antiedge_dist(engine));
-		generate_cloud(fcenter, small_size_dist(engine), i+20, absorbant_volume);
+		trace::zone zone("draw dust");
+		draw_dust(planes, reflective_volume, absorbant_volume, x_begin, x_end);
 	}
 
-	std::cerr << "Drawing dust" << std::endl;
+	std::cerr << "Dust occupies " << reflective_volume.active_bricks() << " reflective and " << absorbant_volume.active_bricks() << " absorbant bricks out of " << density_volume_t::brick_count << std::endl;
+}
 
-	volume<glm::vec4, X, Y, Z> dust_volume;
+nebulagen::nebula_t nebulagen::generate(const size_t x_begin, const size_t x_end)
+{
+	nebula_t nebula(generate_stars());
+	generate_dust(nebula.dust.data() + x_begin * Y * Z, x_begin, x_end);
 
-	for(size_t x = 0; x < X; ++x)
-		for(size_t y = 0; y < Y; ++y)
-			for(size_t z = 0; z < Z; ++z)
-			{
-				constexpr GLfloat division = 0.75;
-				glm::uvec3 pos(x, y, z);
+	return nebula;
+}
 
-				GLfloat absorbant = absorbant_volume[pos] * division;
-				GLfloat reflective = reflective_volume[pos] * (1.0 - division);
+void nebulagen::generate(dust_store_t& store, const size_t slab_width)
+{
+	// Only one slab is ever held; empty voxels are left as they are, so the buffer is cleared between slabs
+	std::vector<dust_t> slab(std::min(slab_width, X) * Y * Z);
 
-				dust_volume[pos].a = glm::clamp(absorbant_volume[pos] + reflective_volume[pos], 0.0f, 1.0f);
-				set_rgb(
-					dust_volume[pos],
-					glm::mix(brownish, blackish, absorbant / (absorbant + reflective))
-				);
-			}
+	for(size_t x_begin = 0; x_begin < X; x_begin += slab_width)
+	{
+		const size_t x_end = std::min(x_begin + slab_width, X);
 
-	return dust_volume;
+		std::fill(slab.begin(), slab.end(), dust_t());
+		generate_dust(slab.data(), x_begin, x_end);
+
+		store.store_slab(slab.data(), x_begin, x_end);
+	}
+
+	store.flush();
 }
 
-nebulagen::nebula_t nebulagen::generate()
+nebulagen::chunk_t nebulagen::generate_chunk(const glm::ivec3& chunk) const
 {
-	return nebula_t(generate_dust(), generate_stars());
+	typedef sparse_volume<GLfloat, CHUNK, CHUNK, CHUNK> chunk_density_t;
+
+	trace::zone zone("generate chunk");
+
+	std::uniform_int_distribution<int> count_dist(0, 6); // Some chunks stay empty, leaving voids between the clouds
+	std::uniform_real_distribution<GLfloat> center_dist(0.0, 1.0);
+	std::uniform_real_distribution<GLfloat> size_dist(0.5, 1.0);
+	std::uniform_real_distribution<GLfloat> small_size_dist(0.2, 0.5);
+	std::uniform_real_distribution<GLfloat> noise_dist(0.0, 1024.0);
+
+	chunk_density_t reflective_volume, absorbant_volume;
+	const glm::vec3 origin(chunk.x, chunk.y, chunk.z);
+
+	// Clouds are at most 1.0 across, so only the direct neighbours reach into this chunk
+	for(int dx = -1; dx <= 1; ++dx)
+		for(int dy = -1; dy <= 1; ++dy)
+			for(int dz = -1; dz <= 1; ++dz)
+			{
+				const glm::ivec3 source = chunk + glm::ivec3(dx, dy, dz);
+				std::seed_seq seq = {(int)m_seed, source.x, source.y, source.z};
+				std::default_random_engine engine(seq);
+
+				const glm::vec3 offset(dx, dy, dz);
+
+				for(int i = count_dist(engine); i > 0; --i)
+				{
+					const glm::vec3 fcenter = offset + glm::vec3(center_dist(engine), center_dist(engine), center_dist(engine));
+					const GLfloat size = size_dist(engine);
+					generate_cloud(fcenter, size, noise_dist(engine), reflective_volume, 0, CHUNK, origin);
+				}
+
+				for(int i = count_dist(engine); i > 0; --i)
+				{
+					const glm::vec3 fcenter = offset + glm::vec3(center_dist(engine), center_dist(engine), center_dist(engine));
+					const GLfloat size = small_size_dist(engine);
+					generate_cloud(fcenter, size, noise_dist(engine), absorbant_volume, 0, CHUNK, origin);
+				}
+			}
+
+	chunk_t dust_volume;
+	draw_dust(dust_volume.data(), reflective_volume, absorbant_volume, 0, CHUNK);
+	return dust_volume;
 }
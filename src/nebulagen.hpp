@@ -2,7 +2,10 @@
 
 #include "nebula.hpp"
 #include "volume.hpp"
+#include "sparsevolume.hpp"
+#include "tiledvolume.hpp"
 #include "star.hpp"
+#include "simplex.hpp"
 
 class nebulagen
 {
@@ -11,20 +14,44 @@ public:
 	static constexpr size_t X = SIZE, Y = SIZE, Z = SIZE;
 	static constexpr GLfloat fX = X, fY = Y, fZ = Z;
 
-	typedef volume_nebula_t<X, Y, Z> nebula_t;
+	typedef rgba8_t dust_t; // Storage type of the dust; the GPU samples it as RGBA8 anyway
+	typedef rgba16f_t light_t; // Storage type of the temporary light volume
+
+	typedef volume_nebula_t<X, Y, Z, dust_t> nebula_t;
+	typedef sparse_volume<GLfloat, X, Y, Z> density_volume_t;
+	typedef tiled_volume<dust_t, X, Y, Z> dust_store_t;
+
+	static constexpr size_t CHUNK = 64; // Resolution of a streamed chunk, which spans one unit of world space
+	typedef volume<dust_t, CHUNK, CHUNK, CHUNK> chunk_t;
 
 private:
 	unsigned int m_seed;
+	simplex m_noise; // Permutation table of the seed, shared by all clouds
 
-	static std::vector<star_t> generate_stars();
-	volume<glm::vec4, X, Y, Z> generate_dust();
+	/* Dust of the x-planes [x_begin, x_end) into planes, which holds just those planes and is zeroed */
+	void generate_dust(dust_t* planes, const size_t x_begin, const size_t x_end);
 
-	void generate_cloud(const glm::vec3 fcenter, const GLfloat size, const GLfloat noise_mod, volume<GLfloat, X, Y, Z>& density_volume);
+	/* Adds a cloud to a density volume spanning [0, 1) of space; origin offsets the noise, so that neighbouring volumes line up */
+	template<size_t SX, size_t SY, size_t SZ>
+	void generate_cloud(const glm::vec3 fcenter, const GLfloat size, const GLfloat noise_mod, sparse_volume<GLfloat, SX, SY, SZ>& density_volume, const size_t x_begin, const size_t x_end, const glm::vec3 origin = glm::vec3()) const;
 
 public:
 	nebulagen(unsigned int seed)
 	: m_seed(seed)
+	, m_noise(seed)
 	{}
 
-	volume_nebula_t<X, Y, Z> generate();
+	static std::vector<star_t> generate_stars();
+
+	/* Only generates dust in the x range [x_begin, x_end), identical to the full volume there; the rest stays empty */
+	nebula_t generate(const size_t x_begin = 0, const size_t x_end = X);
+
+	/* Generates the dust into store, slab_width x-planes at a time */
+	void generate(dust_store_t& store, const size_t slab_width);
+
+	/*
+	 * Unlit dust of the unit cube at chunk in an endless field of clouds. Every chunk seeds its own clouds from its
+	 * coordinates; clouds reach into the neighbouring chunks, which draw them as well, so chunks tile without seams.
+	 */
+	chunk_t generate_chunk(const glm::ivec3& chunk) const;
 };
@@ -58,6 +58,8 @@ void nebulaparticlescene::update_particles(layer_t& layer, const rendercontext&
 
 void nebulaparticlescene::draw_particles(const layer_t& layer, GLuint texture, GLuint atlasSize, const rendercontext& r)
 {
+	gpu_timer::scope timing(r.gpu, "particles");
+
 	const glm::mat4 cube_modelmat = glm::translate(glm::mat4(), m_cube_model);
 
 	gl::bind_buffer(GL_ARRAY_BUFFER, layer.particle_buffer);
@@ -156,13 +158,26 @@ nebulaparticlescene::layer_t::layer_t(const size_t size)
 	glBufferData(GL_ARRAY_BUFFER, size * sizeof(rawparticle_t), NULL, GL_STREAM_DRAW); // Initialize with empty (NULL) buffer : it will be updated later, each frame.
 }
 
+nebulaparticlescene::textures_t nebulaparticlescene::load_textures()
+{
+	return {
+		texture::load_tga("textures/dust.tga", 1024),
+		texture::load_tga("textures/star.tga", 1024)
+	};
+}
+
 nebulaparticlescene::nebulaparticlescene(const particle_nebula_t& nebula, rendercontext& r)
+: nebulaparticlescene(nebula, nullptr, r)
+{}
+
+nebulaparticlescene::nebulaparticlescene(const particle_nebula_t& nebula, const std::shared_ptr<const textures_t>& textures, rendercontext& r)
 : m_nebula(nebula)
 , m_program_particle(false)
 , m_state()
 , m_cube_model(-0.5f, -0.5f, -0.5f)
 , m_mvp()
 , m_ta(4)
+, m_textures(textures)
 {
 	r.add_cb(rcphase::init, [&](rendercontext& r) {
 		check_support();
@@ -175,8 +190,12 @@ nebulaparticlescene::nebulaparticlescene(const particle_nebula_t& nebula, render
 	});
 
 	r.add_cb(rcphase::init, [&](rendercontext& r) {
-		size_t tex_dust = m_ta.add_texture(texture::load_tga("textures/dust.tga", 1024));
-		size_t tex_star = m_ta.add_texture(texture::load_tga("textures/star.tga", 1024));
+		if(!m_textures)
+			m_textures = std::make_shared<const textures_t>(load_textures());
+
+		size_t tex_dust = m_ta.add_texture(m_textures->dust);
+		size_t tex_star = m_ta.add_texture(m_textures->star);
+		m_textures.reset();
 		m_ta.bind();
 
 		static const GLfloat g_vertex_buffer_data[] = {
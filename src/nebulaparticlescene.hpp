@@ -64,6 +64,19 @@ private:
 
 	textureatlas m_ta;
 
+public:
+	/* Texture files of the scene; they can be read ahead of time off the GL thread, see cli */
+	struct textures_t
+	{
+		texture dust, star;
+	};
+
+	static textures_t load_textures();
+
+private:
+	std::shared_ptr<const textures_t> m_textures;
+
 public:
 	nebulaparticlescene(const particle_nebula_t& nebula, rendercontext& r);
+	nebulaparticlescene(const particle_nebula_t& nebula, const std::shared_ptr<const textures_t>& textures, rendercontext& r);
 };
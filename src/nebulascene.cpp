@@ -11,6 +11,26 @@
 
 #include "perlin.hpp"
 #include "nebulagen.hpp"
+#include "volumepyramid.hpp"
+
+/* Largest value among every cell and its 26 neighbours; cells are indexed with z fastest */
+static std::vector<GLubyte> dilate(const std::vector<GLubyte>& data, const glm::uvec3& dim)
+{
+	std::vector<GLubyte> result(data.size(), 0);
+
+	for(int x = 0; x < (int)dim.x; ++x)
+		for(int y = 0; y < (int)dim.y; ++y)
+			for(int z = 0; z < (int)dim.z; ++z)
+			{
+				GLubyte& m = result[x * dim.y * dim.z + y * dim.z + z];
+				for(int nx = std::max(x - 1, 0); nx <= std::min(x + 1, (int)dim.x - 1); ++nx)
+					for(int ny = std::max(y - 1, 0); ny <= std::min(y + 1, (int)dim.y - 1); ++ny)
+						for(int nz = std::max(z - 1, 0); nz <= std::min(z + 1, (int)dim.z - 1); ++nz)
+							m = std::max(m, data[nx * dim.y * dim.z + ny * dim.z + nz]);
+			}
+
+	return result;
+}
 
 void nebulascene::check_support()
 {
@@ -38,25 +58,25 @@ void nebulascene::check_support()
 		throw std::runtime_error("Driver does not support OpenGL Shading Language");
 }
 
-GLuint nebulascene::create_volumetexture()
+/*
+ * Also creates the occupancy texture of the volume: the maximum density of cells of 8^3 voxels, dilated by a cell so that
+ * an empty cell guarantees empty trilinear samples anywhere inside it.
+ */
+GLuint nebulascene::create_volumetexture(occupancy_t& occupancy)
 {
-	GLuint volume_texture;
+	static constexpr size_t occupancy_level = 1; // Cells of 8^3 voxels
 
-	static constexpr size_t size = nebulagen::SIZE*nebulagen::SIZE*nebulagen::SIZE*4;
-	GLubyte *data = new GLubyte[size];
+	{
+		const density_pyramid<nebulagen::X, nebulagen::Y, nebulagen::Z, nebulagen::dust_t> pyramid(m_nebula.dust);
+		const glm::uvec3 dim = pyramid.level(occupancy_level).dim;
+		occupancy = create_occupancytexture(dilate(pyramid.to_texture_data(occupancy_level), dim), dim);
+	}
 
-	for(size_t x = 0; x < nebulagen::SIZE; ++x)
-		for(size_t y = 0; y < nebulagen::SIZE; ++y)
-			for(size_t z = 0; z < nebulagen::SIZE; ++z)
-			{
-				size_t i = x * nebulagen::SIZE * nebulagen::SIZE + y * nebulagen::SIZE + z;
-				glm::vec4& v = m_nebula.dust[glm::uvec3(x, y, z)];
+	GLuint volume_texture;
 
-				data[i*4+0] = v.r*255.0f;
-				data[i*4+1] = v.g*255.0f;
-				data[i*4+2] = v.b*255.0f;
-				data[i*4+3] = v.a*255.0f;
-			}
+	static constexpr size_t size = nebulagen::SIZE*nebulagen::SIZE*nebulagen::SIZE;
+	std::vector<rgba8_t> converted; // Stays empty while the dust is stored as RGBA8
+	const rgba8_t* data = voxel_view(m_nebula.dust.data(), converted, size);
 
 	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
 	gl::generate_textures(1, &volume_texture);
@@ -69,12 +89,46 @@ GLuint nebulascene::create_volumetexture()
 	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
 	gl::texture_image_3d(GL_TEXTURE_3D, 0, GL_RGBA, nebulagen::SIZE, nebulagen::SIZE, nebulagen::SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 
-	delete []data;
 	std::cerr << "Volume texture created" << std::endl;
 
 	return volume_texture;
 }
 
+nebulascene::occupancy_t nebulascene::create_occupancytexture(const std::vector<GLubyte>& data, const glm::uvec3& dim)
+{
+	GLuint texture;
+
+	// Same layout as the volume texture: depth is the x axis. Clamped rather than bordered, so that the cells
+	// around the volume are as occupied as the edge cells that trilinear samples there read from
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	gl::generate_textures(1, &texture);
+	gl::bind_texture(GL_TEXTURE_3D, texture);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	gl::texture_image_3d(GL_TEXTURE_3D, 0, GL_R8, dim.z, dim.y, dim.x, 0, GL_RED, GL_UNSIGNED_BYTE, data.data());
+
+	return {texture, glm::vec3(dim.z, dim.y, dim.x)};
+}
+
+GLuint nebulascene::create_chunktexture()
+{
+	GLuint texture;
+
+	gl::generate_textures(1, &texture);
+	gl::bind_texture(GL_TEXTURE_3D, texture);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	gl::texture_parameter_i(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+	gl::texture_image_3d(GL_TEXTURE_3D, 0, GL_RGBA, nebulagen::CHUNK, nebulagen::CHUNK, nebulagen::CHUNK, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+	return texture;
+}
+
 GLuint nebulascene::create_2dtexture(const size_t width, const size_t height)
 {
 	GLuint texture;
@@ -104,16 +158,19 @@ GLuint nebulascene::create_renderbuffer(const size_t width, const size_t height)
 	return renderbuffer;
 }
 
-void nebulascene::render_frontface()
+void nebulascene::render_frontface(const rendercontext& r, const glm::vec3& model)
 {
 	/* Enable renderbuffers */
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_state->framebuffer);
 	glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, m_state->renderbuffer);
 
+	// At full resolution whatever the scale; the raycast looks its pixels up by screen position
+	gl::viewport(0, 0, r.size().first, r.size().second);
+
 	glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, m_state->frontface_texture, 0);
 	gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	const glm::mat4 cube_modelmat = glm::translate(glm::mat4(), m_cube_model);
+	const glm::mat4 cube_modelmat = glm::translate(glm::mat4(), model);
 
 	m_program_simple.use();
 	m_program_simple.uniform<glm::mat4>("mvp").set(m_mvp * cube_modelmat);
@@ -135,23 +192,51 @@ void nebulascene::render_frontface()
 	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 }
 
-void nebulascene::raycasting_pass(const rendercontext& r)
+/* Pixels of the raycast at the current scale */
+std::pair<size_t, size_t> nebulascene::raycast_size(const rendercontext& r) const
+{
+	return std::make_pair((r.size().first + m_scale - 1) / m_scale, (r.size().second + m_scale - 1) / m_scale);
+}
+
+/* Directs the raycast to the screen at full resolution, otherwise to the lower left corner of final_texture */
+void nebulascene::bind_raycast_target(const rendercontext& r)
+{
+	const std::pair<size_t, size_t> size = raycast_size(r);
+
+	if(m_scale == 1)
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	else
+	{
+		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, m_state->framebuffer);
+		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, m_state->final_texture, 0);
+	}
+
+	gl::viewport(0, 0, size.first, size.second);
+}
+
+/* Raycasts the unit cube at model with the given volume texture, on top of what was drawn before */
+void nebulascene::raycast_volume(const rendercontext& r, const GLuint texture, const occupancy_t& occupancy, const glm::vec3& model)
 {
 	constexpr GLfloat margin = 0.2f;
 
+	const glm::vec3 camera = r.camera.position - model;
 	bool inside_volume = (
-		r.camera.position.x >= -0.5f - margin && r.camera.position.x <= 0.5f + margin &&
-		r.camera.position.y >= -0.5f - margin && r.camera.position.y <= 0.5f + margin &&
-		r.camera.position.z >= -0.5f - margin && r.camera.position.z <= 0.5f + margin
+		camera.x >= -margin && camera.x <= 1.0f + margin &&
+		camera.y >= -margin && camera.y <= 1.0f + margin &&
+		camera.z >= -margin && camera.z <= 1.0f + margin
 	);
 
 	if(!inside_volume)
-		render_frontface();
+	{
+		gpu_timer::scope timing(r.gpu, "frontface");
+		render_frontface(r, model);
+	}
 
-	const glm::mat4 cube_modelmat = glm::translate(glm::mat4(), m_cube_model);
+	bind_raycast_target(r);
 
-	//glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, m_state->final_texture, 0);
-	gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	gpu_timer::scope timing(r.gpu, "raycast");
+
+	const glm::mat4 cube_modelmat = glm::translate(glm::mat4(), model);
 
 	m_program_raycast.use();
 
@@ -160,12 +245,18 @@ void nebulascene::raycasting_pass(const rendercontext& r)
 	m_program_raycast.uniform<GLint>("frontface_tex").set(0);
 
 	gl::active_texture(GL_TEXTURE0 + 1);
-	gl::bind_texture(GL_TEXTURE_3D, m_state->volume_texture);
+	gl::bind_texture(GL_TEXTURE_3D, texture);
 	m_program_raycast.uniform<GLint>("volume_tex").set(1);
 
+	gl::active_texture(GL_TEXTURE0 + 2);
+	gl::bind_texture(GL_TEXTURE_3D, occupancy.texture);
+	m_program_raycast.uniform<GLint>("occupancy_tex").set(2);
+	m_program_raycast.uniform<glm::vec3>("occupancy_size").set(occupancy.size);
+	m_program_raycast.uniform<GLfloat>("thin_stride").set(m_raycast.thin_stride);
+
 	m_program_raycast.uniform<GLint>("inside_volume").set(inside_volume);
 	m_program_raycast.uniform<glm::mat4>("mvp").set(m_mvp * cube_modelmat);
-	m_program_raycast.uniform<glm::vec3>("camerapos").set(r.camera.position - m_cube_model);
+	m_program_raycast.uniform<glm::vec3>("camerapos").set(camera);
 
 	gl::enable(GL_CULL_FACE);
 	glCullFace(GL_FRONT);
@@ -181,8 +272,89 @@ void nebulascene::raycasting_pass(const rendercontext& r)
 	gl::use_program(0);
 }
 
+/*
+ * Scales the reduced-resolution raycast up to the screen, replacing what is there. With depth_aware, the colour is
+ * interpolated relative to the thickness of the volume cube along every ray, which keeps the faint silhouette of the
+ * cube from bleeding out or filling in.
+ */
+void nebulascene::upsample(const rendercontext& r, const bool depth_aware)
+{
+	gpu_timer::scope timing(r.gpu, "upsample");
+
+	const std::pair<size_t, size_t> size = raycast_size(r);
+
+	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	gl::viewport(0, 0, r.size().first, r.size().second);
+
+	m_program_upsample.use();
+
+	gl::active_texture(GL_TEXTURE0 + 0);
+	gl::bind_texture(GL_TEXTURE_2D, m_state->final_texture);
+	m_program_upsample.uniform<GLint>("raycast_tex").set(0);
+
+	m_program_upsample.uniform<glm::vec2>("raycast_size").set(glm::vec2(size.first, size.second));
+	m_program_upsample.uniform<glm::vec2>("raycast_scale").set(glm::vec2((GLfloat)size.first / r.size().first, (GLfloat)size.second / r.size().second));
+	m_program_upsample.uniform<GLint>("depth_aware").set(depth_aware);
+	m_program_upsample.uniform<glm::mat4>("inverse_mvp").set(glm::inverse(m_mvp * glm::translate(glm::mat4(), m_cube_model)));
+	m_program_upsample.uniform<glm::vec3>("camerapos").set(r.camera.position - m_cube_model);
+
+	gl::enable_vertex_attribute_array(0);
+	m_quad_vb.bind(GL_ARRAY_BUFFER);
+	gl::vertex_attribute_pointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	gl::draw_arrays(GL_QUADS, 0, 4);
+	glDisableVertexAttribArray(0);
+
+	gl::use_program(0);
+}
+
+/*
+ * Coarsens the raycast while its GPU time exceeds the budget, and refines it once the finer scale, with four times the
+ * pixels, is expected to fit with room to spare.
+ */
+void nebulascene::adapt_scale(const rendercontext& r)
+{
+	static constexpr size_t settle_frames = 30; // Timings arrive a few frames late; wait for those of the current scale
+	static constexpr size_t window = 10; // Timings the decision is based on
+	static constexpr double headroom = 0.75;
+
+	if(m_raycast.budget <= 0.0 || !r.gpu.available() || ++m_scale_frames < settle_frames)
+		return;
+
+	const double raycast = r.stats.gpu_summary("raycast", window).p50 * 1000.0;
+	const size_t scale = m_scale;
+
+	if(raycast > m_raycast.budget && m_scale < raycast_options::max_scale)
+		m_scale *= 2;
+	else if(raycast * 4.0 < m_raycast.budget * headroom && m_scale > 1)
+		m_scale /= 2;
+
+	if(m_scale != scale)
+	{
+		std::cerr << "Raycasting at 1/" << m_scale << " resolution (" << raycast << " ms)" << std::endl;
+		m_scale_frames = 0;
+	}
+}
+
+void nebulascene::raycasting_pass(const rendercontext& r)
+{
+	gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	if(m_scale > 1)
+	{
+		bind_raycast_target(r);
+		gl::clear(GL_COLOR_BUFFER_BIT);
+	}
+
+	raycast_volume(r, m_state->volume_texture, m_state->occupancy, m_cube_model);
+
+	if(m_scale > 1)
+		upsample(r, true);
+}
+
 void nebulascene::star_pass(const rendercontext& r)
 {
+	gpu_timer::scope timing(r.gpu, "stars");
+
 	const glm::mat4 cube_modelmat = glm::translate(glm::mat4(), m_cube_model);
 
 	glPointSize(5.0);
@@ -200,19 +372,206 @@ void nebulascene::star_pass(const rendercontext& r)
 	glEnd();
 }
 
+bool nebulascene::is_wanted(const glm::ivec3& coord, const glm::vec3& camera) const
+{
+	return glm::distance(glm::vec3(coord.x, coord.y, coord.z) + glm::vec3(0.5f), camera) <= m_stream.radius;
+}
+
+/* Whether any of the unit cube at model may be on screen: false only if all its corners are outside one clip plane */
+bool nebulascene::in_view(const glm::vec3& model) const
+{
+	glm::vec4 corners[8];
+	for(size_t i = 0; i < 8; ++i)
+		corners[i] = m_mvp * glm::vec4(model + glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1), 1.0f);
+
+	for(size_t axis = 0; axis < 3; ++axis)
+		for(const GLfloat side : {-1.0f, 1.0f})
+		{
+			bool outside = true;
+			for(const glm::vec4& c : corners)
+				outside = outside && side * c[axis] > c.w;
+
+			if(outside)
+				return false;
+		}
+
+	return true;
+}
+
+/* Evicts chunks out of range and requests the missing ones; a margin of one chunk keeps chunks at the edge from flickering */
+void nebulascene::stream_chunks(const rendercontext& r)
+{
+	const glm::vec3 camera = r.camera.position;
+	const glm::vec3 direction = r.camera.direction();
+
+	for(auto it = m_chunks.begin(); it != m_chunks.end();)
+	{
+		if(glm::distance(glm::vec3(it->first.x, it->first.y, it->first.z) + glm::vec3(0.5f), camera) > m_stream.radius + 1.0f)
+		{
+			gl::delete_textures(1, &it->second);
+			m_chunks.erase(it++);
+		}
+		else
+			++it;
+	}
+
+	std::map<glm::ivec3, bool, chunk_less> uploading;
+	for(auto it = m_uploads.begin(); it != m_uploads.end();)
+	{
+		if(!is_wanted(it->coord, camera))
+		{
+			gl::delete_textures(1, &it->texture);
+			it = m_uploads.erase(it);
+		}
+		else
+			uploading[(it++)->coord] = true;
+	}
+
+	std::vector<glm::ivec3> wanted;
+	const glm::ivec3 lo(glm::floor(camera - glm::vec3(m_stream.radius))), hi(glm::ceil(camera + glm::vec3(m_stream.radius)));
+	for(int x = lo.x; x <= hi.x; ++x)
+		for(int y = lo.y; y <= hi.y; ++y)
+			for(int z = lo.z; z <= hi.z; ++z)
+			{
+				const glm::ivec3 coord(x, y, z);
+				if(is_wanted(coord, camera) && m_chunks.find(coord) == m_chunks.end() && uploading.find(coord) == uploading.end())
+					wanted.push_back(coord);
+			}
+
+	m_streamer->request(wanted, camera, direction);
+}
+
+/*
+ * Uploads at most upload_budget bytes of chunk data, one x-plane at a time, so that chunks that finish together
+ * do not stall a single frame. Finished chunks that went out of range in the meantime are dropped, as are chunks
+ * that are already resident; a chunk is only popped once the previous upload is done.
+ */
+void nebulascene::upload_chunks()
+{
+	static constexpr size_t plane_size = nebulagen::CHUNK * nebulagen::CHUNK;
+	const size_t budget_planes = std::max<size_t>(1, m_stream.upload_budget / (plane_size * sizeof(rgba8_t)));
+
+	chunkstreamer::ready_t ready;
+	for(size_t planes = 0; planes < budget_planes;)
+	{
+		if(m_uploads.empty())
+		{
+			if(!m_streamer->pop_ready(ready))
+				return;
+
+			if(m_chunks.find(ready.coord) != m_chunks.end())
+				continue;
+
+			m_uploads.push_back({ready.coord, ready.chunk, create_chunktexture(), 0});
+		}
+
+		upload_t& u = m_uploads.front();
+		const size_t count = std::min(budget_planes - planes, nebulagen::CHUNK - u.planes);
+
+		// Texture depth is the x axis of the volume; see create_volumetexture
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		gl::bind_texture(GL_TEXTURE_3D, u.texture);
+		gl::texture_sub_image_3d(GL_TEXTURE_3D, 0, 0, 0, u.planes, nebulagen::CHUNK, nebulagen::CHUNK, count, GL_RGBA, GL_UNSIGNED_BYTE, u.chunk->data() + u.planes * plane_size);
+
+		u.planes += count;
+		planes += count;
+
+		if(u.planes == nebulagen::CHUNK)
+		{
+			m_chunks[u.coord] = u.texture;
+			m_uploads.pop_front();
+		}
+	}
+}
+
+/* Draws the chunks in view back to front, blending each over the ones behind it */
+void nebulascene::chunk_pass(const rendercontext& r)
+{
+	gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	if(m_scale > 1)
+	{
+		bind_raycast_target(r);
+		gl::clear(GL_COLOR_BUFFER_BIT);
+	}
+
+	std::vector<std::pair<GLfloat, std::pair<glm::vec3, GLuint>>> order;
+	for(const auto& c : m_chunks)
+	{
+		// Every chunk costs a frontface pass over the whole frame and a raycast, so the ones off screen are skipped
+		const glm::vec3 model(c.first.x, c.first.y, c.first.z);
+		if(!in_view(model))
+			continue;
+
+		order.push_back(std::make_pair(glm::distance(model + glm::vec3(0.5f), r.camera.position), std::make_pair(model, c.second)));
+	}
+
+	std::sort(order.begin(), order.end(), [](const std::pair<GLfloat, std::pair<glm::vec3, GLuint>>& a, const std::pair<GLfloat, std::pair<glm::vec3, GLuint>>& b) {
+		return a.first > b.first;
+	});
+
+	gl::enable(GL_BLEND);
+	gl::blend_function(GL_ONE, GL_ONE_MINUS_SRC_ALPHA); // The raycaster outputs premultiplied color
+
+	for(const auto& o : order)
+		raycast_volume(r, o.second.second, m_state->chunk_occupancy, o.second.first);
+
+	gl::disable(GL_BLEND);
+
+	// Chunks join up seamlessly; only the single cube has a silhouette to guard
+	if(m_scale > 1)
+		upsample(r, false);
+}
+
 nebulascene::nebulascene(rendercontext &r)
-: nebulascene(nebulagen(4821903).generate(), r)
+: nebulascene(nebulagen(4821903).generate(), r, raycast_options())
 {}
 
-nebulascene::nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r)
+nebulascene::nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r, const raycast_options& raycast)
 : m_nebula(nebula)
 , m_program_simple(false)
 , m_program_raycast(false)
+, m_program_upsample(false)
 , m_va(false)
 , m_vb(false)
+, m_quad_vb(false)
 , m_state()
 , m_cube_model(-0.5f, -0.5f, -0.5f)
 , m_mvp()
+, m_raycast(raycast)
+, m_scale(raycast.scale)
+, m_scale_frames(0)
+, m_stream()
+, m_streamer()
+, m_chunks()
+, m_uploads()
+{
+	setup(r);
+}
+
+nebulascene::nebulascene(const stream_options& stream, rendercontext& r, const raycast_options& raycast)
+: m_nebula()
+, m_program_simple(false)
+, m_program_raycast(false)
+, m_program_upsample(false)
+, m_va(false)
+, m_vb(false)
+, m_quad_vb(false)
+, m_state()
+, m_cube_model(-0.5f, -0.5f, -0.5f)
+, m_mvp()
+, m_raycast(raycast)
+, m_scale(raycast.scale)
+, m_scale_frames(0)
+, m_stream(stream)
+, m_streamer(new chunkstreamer(stream.seed, stream.threads))
+, m_chunks()
+, m_uploads()
+{
+	setup(r);
+}
+
+void nebulascene::setup(rendercontext& r)
 {
 	r.add_cb(rcphase::init, [&](rendercontext& r) {
 		check_support();
@@ -227,6 +586,10 @@ nebulascene::nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r)
 		m_program_raycast.attach(shader::from_file(shader_type::fragment, "shaders/nebularaycast.fragmentshader"));
 		m_program_raycast.link();
 
+		m_program_upsample.attach(shader::from_file(shader_type::vertex, "shaders/nebulaupsample.vertexshader"));
+		m_program_upsample.attach(shader::from_file(shader_type::fragment, "shaders/nebulaupsample.fragmentshader"));
+		m_program_upsample.link();
+
 		m_va.bind();
 
 		m_vb.bind(GL_ARRAY_BUFFER);
@@ -267,7 +630,17 @@ nebulascene::nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r)
 			1.0f, 0.0f, 1.0f,
 		}, GL_STATIC_DRAW);
 
-		GLuint volume_texture = create_volumetexture();
+		m_quad_vb.bind(GL_ARRAY_BUFFER);
+		m_quad_vb.data({
+			-1.0f, -1.0f, 0.0f,
+			1.0f, -1.0f, 0.0f,
+			1.0f, 1.0f, 0.0f,
+			-1.0f, 1.0f, 0.0f,
+		}, GL_STATIC_DRAW);
+
+		occupancy_t occupancy = {0, glm::vec3(0.0f)};
+		GLuint volume_texture = m_streamer ? 0 : create_volumetexture(occupancy);
+		const occupancy_t chunk_occupancy = m_streamer ? create_occupancytexture(std::vector<GLubyte>(1, 255), glm::uvec3(1)) : occupancy_t{0, glm::vec3(0.0f)};
 
 		/* Create framebuffer */
 		GLuint framebuffer;
@@ -281,6 +654,8 @@ nebulascene::nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r)
 
 		m_state.reset({
 			volume_texture,
+			occupancy,
+			chunk_occupancy,
 			framebuffer,
 			frontface_texture,
 			final_texture,
@@ -296,10 +671,35 @@ nebulascene::nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r)
 	r.add_cb(rcphase::update, [&](rendercontext& r) {
 		glm::mat4 projection = glm::perspective(60.0f, (GLfloat)r.size().first/(GLfloat)r.size().second, 0.1f, 100.0f);
 		m_mvp = projection * r.camera.to_matrix();
+
+		adapt_scale(r);
 	});
 
 	r.add_cb(rcphase::draw, [&](rendercontext& r) {
+		if(m_streamer)
+		{
+			stream_chunks(r);
+			{
+				gpu_timer::scope timing(r.gpu, "upload");
+				upload_chunks();
+			}
+			chunk_pass(r);
+			return;
+		}
+
 		raycasting_pass(r);
 		star_pass(r);
 	});
+
+	r.add_cb(rcphase::cleanup, [&](rendercontext&) {
+		m_streamer.reset();
+
+		for(const auto& c : m_chunks)
+			gl::delete_textures(1, &c.second);
+		for(const upload_t& u : m_uploads)
+			gl::delete_textures(1, &u.texture);
+
+		m_chunks.clear();
+		m_uploads.clear();
+	});
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <algorithm>
 #include <GL/glew.h>
 #include <boost/optional.hpp>
 
@@ -9,13 +14,43 @@
 #include "gl/vbo.hpp"
 
 #include "nebulagen.hpp"
+#include "chunkstreamer.hpp"
 
 class nebulascene
 {
+public:
+	/* Endless nebula, generated in chunks of one unit around the camera */
+	struct stream_options
+	{
+		int seed = 4821903;
+		GLfloat radius = 2.5f; // Chunks whose center is within this distance of the camera are generated
+		size_t upload_budget = 512*1024; // Bytes of chunk data uploaded per frame
+		size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 2) - 1;
+	};
+
+	/* Raycasting at a fraction of the resolution, upsampled along the edges of the volume */
+	struct raycast_options
+	{
+		static constexpr size_t max_scale = 4;
+
+		size_t scale = 1; // Pixels per raycast pixel edge: 1, 2 or max_scale
+		double budget = 0.0; // Milliseconds of GPU time for the raycast per frame, which the scale adapts to; 0 to keep it
+		GLfloat thin_stride = 4.0f; // Steps per sample through thin dust; 1 renders as the CPU reference raycaster
+	};
+
 private:
+	/* Maximum density around every cell of a volume texture, which the raycaster leaps over where zero */
+	struct occupancy_t
+	{
+		GLuint texture;
+		glm::vec3 size; // Cells per axis, in texture coordinate order
+	};
+
 	struct state_t
 	{
 		GLuint volume_texture;
+		occupancy_t occupancy;
+		occupancy_t chunk_occupancy; // Chunks have none of their own; a single cell that is never empty
 
 		GLuint framebuffer;
 
@@ -25,28 +60,64 @@ private:
 		GLuint renderbuffer;
 	};
 
+	/* Chunk whose data is being uploaded a few planes per frame; it is drawn once complete */
+	struct upload_t
+	{
+		glm::ivec3 coord;
+		chunkstreamer::chunk_ptr chunk;
+		GLuint texture;
+		size_t planes; // Uploaded so far
+	};
+
 	static void check_support();
-	GLuint create_volumetexture();
+	GLuint create_volumetexture(occupancy_t& occupancy);
+	static occupancy_t create_occupancytexture(const std::vector<GLubyte>& data, const glm::uvec3& dim);
+	static GLuint create_chunktexture();
 	static GLuint create_2dtexture(const size_t width, const size_t height);
 	static GLuint create_renderbuffer(const size_t width, const size_t height);
 
-	void render_frontface();
+	void setup(rendercontext& r);
+
+	void render_frontface(const rendercontext& r, const glm::vec3& model);
+	std::pair<size_t, size_t> raycast_size(const rendercontext& r) const;
+	void bind_raycast_target(const rendercontext& r);
+	void raycast_volume(const rendercontext& r, const GLuint texture, const occupancy_t& occupancy, const glm::vec3& model);
+	void upsample(const rendercontext& r, const bool depth_aware);
+	void adapt_scale(const rendercontext& r);
 	void raycasting_pass(const rendercontext& r);
 	void star_pass(const rendercontext& r);
 
+	bool is_wanted(const glm::ivec3& coord, const glm::vec3& camera) const;
+	bool in_view(const glm::vec3& model) const;
+	void stream_chunks(const rendercontext& r);
+	void upload_chunks();
+	void chunk_pass(const rendercontext& r);
+
 	nebulagen::nebula_t m_nebula;
 
 	shader_program m_program_simple;
 	shader_program m_program_raycast;
+	shader_program m_program_upsample;
 
 	vao m_va;
 	vbo<GLfloat> m_vb;
+	vbo<GLfloat> m_quad_vb; // Covers the screen
 	boost::optional<state_t> m_state;
 
 	glm::vec3 m_cube_model;
 	glm::mat4 m_mvp;
 
+	raycast_options m_raycast;
+	size_t m_scale; // Current, see raycast_options
+	size_t m_scale_frames; // Rendered at the current scale
+
+	stream_options m_stream;
+	std::unique_ptr<chunkstreamer> m_streamer; // Only in streaming mode
+	std::map<glm::ivec3, GLuint, chunk_less> m_chunks; // Uploaded chunk textures
+	std::deque<upload_t> m_uploads;
+
 public:
 	nebulascene(rendercontext& r);
-	nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r);
+	nebulascene(const nebulagen::nebula_t& nebula, rendercontext& r, const raycast_options& raycast);
+	nebulascene(const stream_options& stream, rendercontext& r, const raycast_options& raycast);
 };
@@ -0,0 +1,186 @@
+#include "nebulashard.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#include "volumelighting.hpp"
+#include "util/trace.hpp"
+
+constexpr uint32_t nebulashard::version;
+
+typedef volumelighting<nebulagen::X, nebulagen::Y, nebulagen::Z, nebulagen::dust_t, nebulagen::light_t> lighting_t;
+
+static constexpr size_t plane_size = nebulagen::Y * nebulagen::Z;
+
+std::string nebulashard::slab_name(const int seed, const size_t i, const size_t n)
+{
+	return "shard_" + std::to_string(seed) + "_" + std::to_string(i) + "_" + std::to_string(n) + ".slab";
+}
+
+void nebulashard::light_shard(const int seed, const size_t i, const size_t n, const dust_source_t& source)
+{
+	const size_t x_begin = slab_begin(i, n), x_end = slab_begin(i + 1, n);
+
+	const std::vector<star_t> stars = nebulagen::generate_stars();
+	const std::pair<size_t, size_t> halo = lighting_t::shadow_halo(stars, x_begin, x_end);
+
+	// The halo is lit from a dense copy whatever the dust source, so it bounds the memory of a shard
+	const size_t halo_bytes = (halo.second - halo.first) * plane_size * sizeof(nebulagen::dust_t);
+	std::cerr << "Shard " << i << "/" << n << ": slab [" << x_begin << ", " << x_end << "), dust [" << halo.first << ", " << halo.second << ") ("
+		<< 100 * (halo.second - halo.first) / nebulagen::X << "% of the volume, " << (halo_bytes >> 20) << " MiB)" << std::endl;
+
+	const nebulagen::nebula_t nebula = source(halo.first, halo.second);
+
+	std::cerr << "Raycasting stars" << std::endl;
+
+	volume<nebulagen::light_t, nebulagen::X, nebulagen::Y, nebulagen::Z> light_volume;
+	const GLfloat max_intensity = lighting_t::light_slab(nebula, light_volume, x_begin, x_end);
+
+	slab_header h;
+	std::memcpy(h.magic, "NSLB", 4);
+	h.version = version;
+	h.x = nebulagen::X;
+	h.y = nebulagen::Y;
+	h.z = nebulagen::Z;
+	h.x_begin = x_begin;
+	h.x_end = x_end;
+	h.seed = seed;
+	h.dust_size = sizeof(nebulagen::dust_t);
+	h.light_size = sizeof(nebulagen::light_t);
+	h.max_intensity = max_intensity;
+
+	// X is the slowest axis, so a slab is one contiguous run of voxels
+	const size_t offset = x_begin * plane_size, count = (x_end - x_begin) * plane_size;
+
+	const std::string filename = slab_name(seed, i, n);
+	const std::string tmp = filename + ".tmp";
+	{
+		std::ofstream os(tmp, std::ios::binary);
+		os.write((const char*)&h, sizeof(h));
+		os.write((const char*)(nebula.dust.data() + offset), count * sizeof(nebulagen::dust_t));
+		os.write((const char*)(light_volume.data() + offset), count * sizeof(nebulagen::light_t));
+
+		if(!os)
+			throw std::runtime_error("Could not write " + tmp);
+	}
+
+	if(std::rename(tmp.c_str(), filename.c_str()) != 0)
+		throw std::runtime_error("Could not write " + filename);
+
+	std::cerr << "Wrote " << filename << std::endl;
+}
+
+void nebulashard::generate_shard(const int seed, const size_t i, const size_t n)
+{
+	light_shard(seed, i, n, [seed](const size_t x_begin, const size_t x_end) {
+		return nebulagen(seed).generate(x_begin, x_end);
+	});
+}
+
+void nebulashard::generate_shard(const int seed, const size_t i, const size_t n, nebulagen::dust_store_t& store)
+{
+	light_shard(seed, i, n, [&store](const size_t x_begin, const size_t x_end) {
+		trace::zone zone("load dust");
+
+		// Only the planes read are touched, so the rest of the volume stays unallocated
+		nebulagen::nebula_t nebula(nebulagen::generate_stars());
+		store.prefetch(glm::uvec3(x_begin, 0, 0), glm::uvec3(x_end, nebulagen::Y, nebulagen::Z));
+		store.load_slab(nebula.dust.data() + x_begin * plane_size, x_begin, x_end);
+
+		return nebula;
+	});
+}
+
+nebulashard::slab_header nebulashard::read_header(std::istream& is, const std::string& filename, const int seed)
+{
+	slab_header h;
+	is.read((char*)&h, sizeof(h));
+
+	if(!is || std::memcmp(h.magic, "NSLB", 4) != 0 || h.version != version)
+		throw std::runtime_error(filename + " is not a slab file");
+
+	if(h.x != nebulagen::X || h.y != nebulagen::Y || h.z != nebulagen::Z || h.dust_size != sizeof(nebulagen::dust_t) || h.light_size != sizeof(nebulagen::light_t))
+		throw std::runtime_error(filename + " was written for a different volume layout");
+
+	if(h.seed != seed)
+		throw std::runtime_error(filename + " belongs to seed " + std::to_string(h.seed));
+
+	return h;
+}
+
+void nebulashard::merge_slabs(const int seed, const size_t n, const slab_target_t& target, const slab_done_t& done)
+{
+	const std::vector<star_t> stars = nebulagen::generate_stars();
+
+	// The light is normalized by the brightest voxel of the whole volume, so all headers are needed first
+	GLfloat max_intensity = 0.0f;
+	for(size_t i = 0; i < n; ++i)
+	{
+		const std::string filename = slab_name(seed, i, n);
+		std::ifstream is(filename, std::ios::binary);
+		if(!is)
+			throw std::runtime_error("Missing shard " + filename);
+
+		const slab_header h = read_header(is, filename, seed);
+		if(h.x_begin != slab_begin(i, n) || h.x_end != slab_begin(i + 1, n))
+			throw std::runtime_error(filename + " covers a different slab");
+
+		max_intensity = std::max(max_intensity, h.max_intensity);
+	}
+
+	std::cerr << "Merging " << n << " shards" << std::endl;
+
+	std::vector<nebulagen::light_t> light;
+	for(size_t i = 0; i < n; ++i)
+	{
+		const std::string filename = slab_name(seed, i, n);
+		std::ifstream is(filename, std::ios::binary);
+		const slab_header h = read_header(is, filename, seed);
+
+		const std::string zone_name = "merge " + filename;
+		trace::zone zone(zone_name);
+
+		const size_t count = (h.x_end - h.x_begin) * plane_size;
+		nebulagen::dust_t* dust = target(h.x_begin, h.x_end);
+
+		light.resize(count);
+		is.read((char*)dust, count * sizeof(nebulagen::dust_t));
+		is.read((char*)light.data(), count * sizeof(nebulagen::light_t));
+
+		if(!is)
+			throw std::runtime_error(filename + " is truncated");
+
+		lighting_t::apply_lighting_to_dust(dust, light.data(), h.x_begin, h.x_end, max_intensity / ((GLfloat) stars.size()));
+		done(h.x_begin, h.x_end);
+	}
+}
+
+nebulagen::nebula_t nebulashard::merge(const int seed, const size_t n)
+{
+	nebulagen::nebula_t nebula(nebulagen::generate_stars());
+
+	merge_slabs(seed, n, [&nebula](const size_t x_begin, const size_t) {
+		return nebula.dust.data() + x_begin * plane_size;
+	}, [](const size_t, const size_t) {});
+
+	return nebula;
+}
+
+void nebulashard::merge(const int seed, const size_t n, nebulagen::dust_store_t& store)
+{
+	std::vector<nebulagen::dust_t> slab;
+
+	merge_slabs(seed, n, [&slab](const size_t x_begin, const size_t x_end) {
+		slab.resize((x_end - x_begin) * plane_size);
+		return slab.data();
+	}, [&slab, &store](const size_t x_begin, const size_t x_end) {
+		store.store_slab(slab.data(), x_begin, x_end);
+	});
+
+	store.flush();
+}
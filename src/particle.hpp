@@ -10,3 +10,22 @@ struct particle_t
 
 	MSGPACK_DEFINE(pos, color)
 };
+
+MSGPACK_BLOB_TYPE(particle_t, 4)
+
+namespace msgpack {
+
+	/* Particle sets run into the millions; pack them as a single blob */
+	inline std::vector<particle_t>& operator>>(object o, std::vector<particle_t>& v)
+	{
+		msgpack_blob::unpack_vector(o, v);
+		return v;
+	}
+
+	template <typename Stream>
+	inline packer<Stream>& operator<<(packer<Stream>& o, const std::vector<particle_t>& v)
+	{
+		msgpack_blob::pack_vector(o, v);
+		return o;
+	}
+}
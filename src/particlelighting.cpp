@@ -8,6 +8,7 @@
 #include <glm/gtx/intersect.hpp>
 
 #include "tri.hpp"
+#include "util/trace.hpp"
 
 static constexpr GLfloat _A = 0.525731112119133606f;
 static constexpr GLfloat _B = 0.850650808352039932f;
@@ -109,9 +110,15 @@ inline void draw_tris<0>(tri t)
 	glVertex3f(t.c.x, t.c.y, t.c.z);
 }
 
+constexpr size_t particlelighting::LAYERS;
+
+size_t particlelighting::light_bin(const glm::vec3& source, const glm::vec3& target)
+{
+	return line_to_index<LAYERS>(source, target);
+}
+
 void particlelighting::apply_lighting(particle_nebula_t& n)
 {
-	static constexpr size_t LAYERS = 7;
 	static const size_t tri_count = 20*std::pow(4, LAYERS);
 	static const GLfloat shadowing_factor = std::pow(std::pow(0.9f, 1.0f/40.0f), std::pow(2.0f, (GLfloat)LAYERS));
 	static const GLfloat density_factor = 0.1;
@@ -129,18 +136,23 @@ void particlelighting::apply_lighting(particle_nebula_t& n)
 		std::vector<GLfloat> tris_lighting(tri_count, 1.0f);
 
 		// Sort particles on distance from the light source
-		for(size_t i = 0; i < n.particles.size(); ++i)
-			zs[i] = glm::distance(s.pos, n.particles[i].pos);
-
-		std::sort(tmp_index.begin(), tmp_index.end(), [&](const size_t a, const size_t b)
 		{
-			return zs[a] < zs[b];
-		});
+			trace::zone zone("sort particles");
+
+			for(size_t i = 0; i < n.particles.size(); ++i)
+				zs[i] = glm::distance(s.pos, n.particles[i].pos);
+
+			std::sort(tmp_index.begin(), tmp_index.end(), [&](const size_t a, const size_t b)
+			{
+				return zs[a] < zs[b];
+			});
+		}
 
+		trace::zone zone("shadow particles");
 		for(size_t i : tmp_index)
 		{
 			GLfloat dist = glm::abs(glm::length(s.pos - n.particles[i].pos));
-			size_t j = line_to_index<LAYERS>(s.pos, n.particles[i].pos);
+			size_t j = light_bin(s.pos, n.particles[i].pos);
 
 			GLfloat power = 1.0f / std::pow(dist+1.0f, 2.0f);
 			light[i] += s.color * tris_lighting[j] * power;
@@ -9,7 +9,12 @@ private:
 	particlelighting(particlelighting&) = delete;
 	particlelighting& operator=(particlelighting) = delete;
 
+	static constexpr size_t LAYERS = 7; // Subdivisions of the icosahedron that bins the directions from a star
+
 public:
 	static void apply_lighting(particle_nebula_t&);
+
+	/* Index of the direction bin that the ray from source through target falls in */
+	static size_t light_bin(const glm::vec3& source, const glm::vec3& target);
 	static void draw_debug();
 };
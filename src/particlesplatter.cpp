@@ -0,0 +1,311 @@
+#include "particlesplatter.hpp"
+
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "util/parallel.hpp"
+#include "util/trace.hpp"
+
+typedef std::vector<glm::vec4> texels_t;
+
+/* Bilinear texel of a level at texture coordinates (u, v), clamped to its edges */
+static void bilinear_footprint(const size_t size, const GLfloat u, const GLfloat v, size_t (&index)[4], GLfloat& wx, GLfloat& wy)
+{
+	const GLfloat tx = u * size - 0.5f, ty = v * size - 0.5f;
+	const GLfloat fx = std::floor(tx), fy = std::floor(ty);
+	wx = tx - fx;
+	wy = ty - fy;
+
+	const int last = (int)size - 1;
+	const size_t x0 = glm::clamp((int)fx, 0, last), x1 = glm::clamp((int)fx + 1, 0, last);
+	const size_t y0 = glm::clamp((int)fy, 0, last), y1 = glm::clamp((int)fy + 1, 0, last);
+
+	index[0] = y0 * size + x0;
+	index[1] = y0 * size + x1;
+	index[2] = y1 * size + x0;
+	index[3] = y1 * size + x1;
+}
+
+#ifdef __SSE2__
+static inline __m128 lerp4(const __m128 a, const __m128 b, const GLfloat t)
+{
+	return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), _mm_set1_ps(t)));
+}
+
+static inline __m128 bilinear(const texels_t& texels, const size_t size, const GLfloat u, const GLfloat v)
+{
+	size_t i[4];
+	GLfloat wx, wy;
+	bilinear_footprint(size, u, v, i, wx, wy);
+
+	const __m128 top = lerp4(_mm_loadu_ps(&texels[i[0]].x), _mm_loadu_ps(&texels[i[1]].x), wx);
+	const __m128 bottom = lerp4(_mm_loadu_ps(&texels[i[2]].x), _mm_loadu_ps(&texels[i[3]].x), wx);
+	return lerp4(top, bottom, wy);
+}
+
+/* dst = src * src.a + dst * (1 - src.a), all four channels at once; src is the texel times the particle colour */
+static inline void blend(GLfloat* dst, const __m128 texel, const __m128 color)
+{
+	const __m128 src = _mm_mul_ps(texel, color);
+	const __m128 a = _mm_shuffle_ps(src, src, _MM_SHUFFLE(3, 3, 3, 3));
+	const __m128 d = _mm_loadu_ps(dst);
+	_mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(src, a), _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(1.0f), a))));
+}
+#else
+static inline glm::vec4 bilinear(const texels_t& texels, const size_t size, const GLfloat u, const GLfloat v)
+{
+	size_t i[4];
+	GLfloat wx, wy;
+	bilinear_footprint(size, u, v, i, wx, wy);
+
+	return glm::mix(glm::mix(texels[i[0]], texels[i[1]], wx), glm::mix(texels[i[2]], texels[i[3]], wx), wy);
+}
+
+static inline void blend(GLfloat* dst, const glm::vec4& texel, const glm::vec4& color)
+{
+	const glm::vec4 src = texel * color;
+	for(size_t c = 0; c < 4; ++c)
+		dst[c] = src[c] * src.a + dst[c] * (1.0f - src.a);
+}
+#endif
+
+static uint8_t to_unorm8(const GLfloat v)
+{
+	return glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f;
+}
+
+particle_splatter::sprite_t::sprite_t(const texture& t)
+: levels()
+{
+	level_t base;
+	base.size = t.size;
+	base.texels.resize(t.size * t.size);
+	for(size_t i = 0; i < base.texels.size(); ++i)
+	{
+		const GLubyte* p = t.data.get() + i * 4;
+		base.texels[i] = glm::vec4(p[0], p[1], p[2], p[3]) / 255.0f;
+	}
+
+	levels.push_back(std::move(base));
+
+	// Box filtered, down to a single texel
+	while(levels.back().size > 1)
+	{
+		const level_t& fine = levels.back();
+
+		level_t coarse;
+		coarse.size = fine.size / 2;
+		coarse.texels.resize(coarse.size * coarse.size);
+		for(size_t y = 0; y < coarse.size; ++y)
+			for(size_t x = 0; x < coarse.size; ++x)
+			{
+				const size_t i = 2 * y * fine.size + 2 * x;
+				coarse.texels[y * coarse.size + x] = (fine.texels[i] + fine.texels[i + 1] + fine.texels[i + fine.size] + fine.texels[i + fine.size + 1]) * 0.25f;
+			}
+
+		levels.push_back(std::move(coarse));
+	}
+}
+
+particle_splatter::particle_splatter(const particle_nebula_t& nebula, const texture& dust, const texture& star)
+: m_nebula(nebula)
+, m_sprites()
+{
+	// In the order of sprite_id
+	m_sprites.emplace_back(dust);
+	m_sprites.emplace_back(star);
+}
+
+bool particle_splatter::project(splat_t& s, const glm::vec3& pos, const GLfloat size, const glm::vec4& color, const sprite_id sprite, const glm::mat4& projection, const glm::mat4& modelview, const size_t width, const size_t height) const
+{
+	const glm::vec4 center = modelview * glm::vec4(pos.x, pos.y, pos.z, 1.0f);
+	const GLfloat h = size * 0.5f;
+
+	// Camera right and up are the x and y axes of view space
+	const glm::vec4 lo = projection * glm::vec4(center.x - h, center.y - h, center.z, 1.0f);
+	const glm::vec4 hi = projection * glm::vec4(center.x + h, center.y + h, center.z, 1.0f);
+
+	if(lo.w <= 0.0f || lo.z < -lo.w || lo.z > lo.w)
+		return false; // Outside of the near and far planes
+
+	s.x0 = (lo.x / lo.w + 1.0f) * 0.5f * width;
+	s.y0 = (1.0f - hi.y / hi.w) * 0.5f * height;
+	const GLfloat x1 = (hi.x / hi.w + 1.0f) * 0.5f * width;
+	const GLfloat y1 = (1.0f - lo.y / lo.w) * 0.5f * height;
+
+	// Pixels whose centers lie inside, as GL rasterizes
+	s.px_begin = std::max<int>(std::ceil(s.x0 - 0.5f), 0);
+	s.px_end = std::min<int>(std::ceil(x1 - 0.5f), width);
+	s.py_begin = std::max<int>(std::ceil(s.y0 - 0.5f), 0);
+	s.py_end = std::min<int>(std::ceil(y1 - 0.5f), height);
+
+	if(s.px_begin >= s.px_end || s.py_begin >= s.py_end)
+		return false;
+
+	const GLfloat extent = std::max(x1 - s.x0, y1 - s.y0);
+	const sprite_t& sp = m_sprites[(size_t)sprite];
+
+	s.inv_width = 1.0f / (x1 - s.x0);
+	s.inv_height = 1.0f / (y1 - s.y0);
+	s.depth = -center.z;
+	s.lod = glm::clamp(std::log2(sp.levels.front().size / extent), 0.0f, (GLfloat)(sp.levels.size() - 1));
+	s.color = color;
+	s.sprite = sprite;
+	return true;
+}
+
+/* Splats of the particles and stars, in chunks that were projected in parallel */
+std::vector<std::vector<particle_splatter::splat_t>> particle_splatter::project_all(const glm::mat4& projection, const glm::mat4& modelview, const size_t width, const size_t height) const
+{
+	trace::zone zone("project particles");
+
+	// Sizes and colours as the particle scene gives them
+	static constexpr GLfloat dust_scale = 0.008f;
+	static constexpr GLfloat star_size = 0.3f;
+	static constexpr GLfloat star_intensity = 1.3f;
+
+	const size_t particle_count = m_nebula.particles.size();
+	const size_t count = particle_count + m_nebula.stars.size();
+	const size_t chunk_count = std::max<size_t>(std::thread::hardware_concurrency(), 1) * 4;
+
+	std::vector<std::vector<splat_t>> chunks(chunk_count);
+	parallel_for(0, chunk_count, [&](const size_t c) {
+		std::vector<splat_t>& out = chunks[c];
+
+		splat_t s;
+		for(size_t i = count * c / chunk_count; i < count * (c + 1) / chunk_count; ++i)
+		{
+			if(i < particle_count)
+			{
+				const particle_t& p = m_nebula.particles[i];
+				if(project(s, p.pos, p.color.a * dust_scale, p.color, sprite_id::dust, projection, modelview, width, height))
+					out.push_back(s);
+			}
+			else
+			{
+				const star_t& st = m_nebula.stars[i - particle_count];
+				if(project(s, st.pos, star_size, glm::vec4(st.color.r, st.color.g, st.color.b, 1.0f) * star_intensity, sprite_id::star, projection, modelview, width, height))
+					out.push_back(s);
+			}
+		}
+	});
+
+	return chunks;
+}
+
+void particle_splatter::render_tile(rgb_image& image, std::vector<bin_entry_t>& bin, const size_t x_begin, const size_t y_begin) const
+{
+	const int x_end = std::min(x_begin + tile_size, image.width), y_end = std::min(y_begin + tile_size, image.height);
+
+	// Back to front; stable, so that equal depths keep the order of the particles
+	std::stable_sort(bin.begin(), bin.end(), [](const bin_entry_t& a, const bin_entry_t& b) {
+		return a.depth > b.depth;
+	});
+
+	GLfloat tile[tile_size * tile_size * 4] = {};
+
+	for(const bin_entry_t& e : bin)
+	{
+		const splat_t& s = *e.splat;
+		const sprite_t& sprite = m_sprites[(size_t)s.sprite];
+
+		// Trilinear between two mipmap levels, as GL_LINEAR_MIPMAP_LINEAR
+		const size_t l0 = s.lod, l1 = std::min(l0 + 1, sprite.levels.size() - 1);
+		const GLfloat lf = s.lod - l0;
+		const sprite_t::level_t& fine = sprite.levels[l0];
+		const sprite_t::level_t& coarse = sprite.levels[l1];
+
+#ifdef __SSE2__
+		const __m128 color = _mm_loadu_ps(&s.color.x);
+#else
+		const glm::vec4& color = s.color;
+#endif
+
+		for(int py = std::max<int>(s.py_begin, y_begin); py < std::min(s.py_end, y_end); ++py)
+		{
+			const GLfloat v = 1.0f - ((GLfloat)py + 0.5f - s.y0) * s.inv_height; // t runs up the billboard
+			for(int px = std::max<int>(s.px_begin, x_begin); px < std::min(s.px_end, x_end); ++px)
+			{
+				const GLfloat u = ((GLfloat)px + 0.5f - s.x0) * s.inv_width;
+				GLfloat* dst = tile + ((py - y_begin) * tile_size + (px - x_begin)) * 4;
+
+#ifdef __SSE2__
+				const __m128 texel = lerp4(bilinear(fine.texels, fine.size, u, v), bilinear(coarse.texels, coarse.size, u, v), lf);
+#else
+				const glm::vec4 texel = glm::mix(bilinear(fine.texels, fine.size, u, v), bilinear(coarse.texels, coarse.size, u, v), lf);
+#endif
+				blend(dst, texel, color);
+			}
+		}
+	}
+
+	for(int y = y_begin; y < y_end; ++y)
+		for(int x = x_begin; x < x_end; ++x)
+		{
+			const GLfloat* src = tile + ((y - y_begin) * tile_size + (x - x_begin)) * 4;
+			uint8_t* p = image.pixel(x, y);
+			p[0] = to_unorm8(src[0]);
+			p[1] = to_unorm8(src[1]);
+			p[2] = to_unorm8(src[2]);
+		}
+}
+
+void particle_splatter::render(rgb_image& image, const glm::mat4& projection, const glm::mat4& modelview) const
+{
+	trace::zone zone("cpu splat");
+
+	const std::vector<std::vector<splat_t>> chunks = project_all(projection, modelview, image.width, image.height);
+
+	const size_t tiles_x = (image.width + tile_size - 1) / tile_size;
+	const size_t tiles_y = (image.height + tile_size - 1) / tile_size;
+	const size_t tile_count = tiles_x * tiles_y;
+
+	// Binning in two passes: every chunk counts its splats per tile, then writes them at its offset within each bin
+	std::vector<size_t> offsets(chunks.size() * tile_count, 0);
+	std::vector<std::vector<bin_entry_t>> bins(tile_count);
+	{
+		trace::zone bin_zone("bin particles");
+
+		parallel_for(0, chunks.size(), [&](const size_t c) {
+			size_t* counts = offsets.data() + c * tile_count;
+			for(const splat_t& s : chunks[c])
+				for(size_t ty = s.py_begin / tile_size; ty <= (s.py_end - 1) / tile_size; ++ty)
+					for(size_t tx = s.px_begin / tile_size; tx <= (s.px_end - 1) / tile_size; ++tx)
+						++counts[ty * tiles_x + tx];
+		});
+
+		for(size_t t = 0; t < tile_count; ++t)
+		{
+			size_t total = 0;
+			for(size_t c = 0; c < chunks.size(); ++c)
+			{
+				const size_t n = offsets[c * tile_count + t];
+				offsets[c * tile_count + t] = total;
+				total += n;
+			}
+
+			bins[t].resize(total);
+		}
+
+		parallel_for(0, chunks.size(), [&](const size_t c) {
+			size_t* next = offsets.data() + c * tile_count;
+			for(const splat_t& s : chunks[c])
+				for(size_t ty = s.py_begin / tile_size; ty <= (s.py_end - 1) / tile_size; ++ty)
+					for(size_t tx = s.px_begin / tile_size; tx <= (s.px_end - 1) / tile_size; ++tx)
+					{
+						const size_t t = ty * tiles_x + tx;
+						bins[t][next[t]++] = {s.depth, &s};
+					}
+		});
+	}
+
+	// Bins differ wildly in size with the density of the nebula on screen
+	parallel_for_stealing(0, tile_count, [&](const size_t t) {
+		render_tile(image, bins[t], (t % tiles_x) * tile_size, (t / tiles_x) * tile_size);
+	});
+}
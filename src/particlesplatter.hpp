@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include "nebula.hpp"
+
+#include "gl/texture.hpp"
+#include "util/image.hpp"
+
+/*
+ * CPU implementation of the particle scene, for rendering without a GPU and as a reference for the GL path.
+ * Particles become the same camera-facing billboards as in nebulaparticle.vertexshader, textured with the dust and
+ * star sprites and blended back to front with GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA.
+ *
+ * Billboards are projected in parallel and binned into screen tiles; every tile then sorts its own billboards by depth
+ * and blends them into a small float buffer, so tiles render independently.
+ */
+class particle_splatter
+{
+public:
+	static constexpr size_t tile_size = 32; // Pixels per tile edge
+
+private:
+	/* Mipmapped RGBA sprite, as glGenerateMipmap builds it */
+	struct sprite_t
+	{
+		struct level_t
+		{
+			size_t size;
+			std::vector<glm::vec4> texels; // Rows from t = 0
+		};
+
+		std::vector<level_t> levels;
+
+		sprite_t(const texture& t);
+	};
+
+	enum class sprite_id : uint32_t
+	{
+		dust,
+		star
+	};
+
+	/* Billboard in screen space; billboards face the camera, so they project to upright rectangles */
+	struct splat_t
+	{
+		GLfloat x0, y0; // Top left corner in pixels, rows from the top
+		GLfloat inv_width, inv_height; // Per pixel
+		int px_begin, px_end, py_begin, py_end; // Pixels whose centers it covers
+		GLfloat depth; // Distance in front of the camera
+		GLfloat lod; // Mipmap level, fractional
+		glm::vec4 color;
+		sprite_id sprite;
+	};
+
+	struct bin_entry_t
+	{
+		GLfloat depth;
+		const splat_t* splat;
+	};
+
+	const particle_nebula_t& m_nebula;
+	std::vector<sprite_t> m_sprites; // Indexed by sprite_id
+
+	/* Splat of the billboard of the given size at pos, if it covers any pixel of the image */
+	bool project(splat_t& s, const glm::vec3& pos, const GLfloat size, const glm::vec4& color, const sprite_id sprite, const glm::mat4& projection, const glm::mat4& modelview, const size_t width, const size_t height) const;
+
+	std::vector<std::vector<splat_t>> project_all(const glm::mat4& projection, const glm::mat4& modelview, const size_t width, const size_t height) const;
+	void render_tile(rgb_image& image, std::vector<bin_entry_t>& bin, const size_t x_begin, const size_t y_begin) const;
+
+public:
+	particle_splatter(const particle_nebula_t& nebula, const texture& dust, const texture& star);
+
+	/*
+	 * Renders the particles into image, on black. projection and modelview are those of the GL path, with the model
+	 * transform of the particle cube in modelview.
+	 */
+	void render(rgb_image& image, const glm::mat4& projection, const glm::mat4& modelview) const;
+};
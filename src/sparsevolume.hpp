@@ -0,0 +1,219 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <memory>
+
+#include "volume.hpp"
+
+/* Brick-map volume; only bricks that were written to are allocated, all others read as the background value. */
+template<typename T, size_t X, size_t Y, size_t Z, size_t B = 16>
+class sparse_volume
+{
+public:
+	static constexpr size_t brick_size = B;
+	static constexpr size_t BX = (X + B - 1) / B, BY = (Y + B - 1) / B, BZ = (Z + B - 1) / B;
+	static constexpr size_t brick_count = BX*BY*BZ;
+
+	typedef std::array<T, B*B*B> brick_t;
+
+private:
+	T m_background;
+	std::vector<std::unique_ptr<brick_t>> m_bricks;
+
+	static size_t brick_index(const glm::uvec3& pos)
+	{
+		return (pos.x / B) * BY * BZ + (pos.y / B) * BZ + (pos.z / B);
+	}
+
+	static size_t voxel_index(const glm::uvec3& pos)
+	{
+		return (pos.x % B) * B * B + (pos.y % B) * B + (pos.z % B);
+	}
+
+	brick_t& acquire_brick(const size_t i)
+	{
+		if(!m_bricks[i])
+		{
+			m_bricks[i].reset(new brick_t());
+			m_bricks[i]->fill(m_background);
+		}
+
+		return *m_bricks[i];
+	}
+
+public:
+	sparse_volume(const T background = T())
+	: m_background(background)
+	, m_bricks(brick_count)
+	{}
+
+	sparse_volume(sparse_volume&&) = default;
+	sparse_volume& operator=(sparse_volume&&) = default;
+
+	sparse_volume(const sparse_volume&) = delete;
+	sparse_volume& operator=(const sparse_volume&) = delete;
+
+	const T& background() const
+	{
+		return m_background;
+	}
+
+	/* Allocates the containing brick; use the const overload for pure reads */
+	T& operator[](const glm::uvec3& pos)
+	{
+		return acquire_brick(brick_index(pos))[voxel_index(pos)];
+	}
+
+	const T& operator[](const glm::uvec3& pos) const
+	{
+		const std::unique_ptr<brick_t>& brick = m_bricks[brick_index(pos)];
+		if(!brick)
+			return m_background;
+
+		return (*brick)[voxel_index(pos)];
+	}
+
+	bool is_active(const size_t brick) const
+	{
+		return (bool)m_bricks[brick];
+	}
+
+	size_t active_bricks() const
+	{
+		size_t result = 0;
+		for(const auto& brick : m_bricks)
+			if(brick)
+				++result;
+
+		return result;
+	}
+
+	static glm::uvec3 brick_origin(const size_t brick)
+	{
+		return glm::uvec3(
+			(brick / (BY * BZ)) * B,
+			((brick / BZ) % BY) * B,
+			(brick % BZ) * B
+		);
+	}
+
+	/* One past the last voxel of a brick, clipped to the volume bounds */
+	static glm::uvec3 brick_end(const size_t brick)
+	{
+		return glm::min(brick_origin(brick) + glm::uvec3(B), glm::uvec3(X, Y, Z));
+	}
+
+	/* Calls f(pos) for every voxel of a brick, clipped to the volume bounds */
+	template<typename F>
+	static void for_each_voxel_in_brick(const size_t brick, F f)
+	{
+		const glm::uvec3 origin = brick_origin(brick);
+		const glm::uvec3 end = brick_end(brick);
+
+		for(size_t x = origin.x; x < end.x; ++x)
+			for(size_t y = origin.y; y < end.y; ++y)
+				for(size_t z = origin.z; z < end.z; ++z)
+					f(glm::uvec3(x, y, z));
+	}
+
+	/* Calls f(pos, value) for every voxel in an allocated brick; background space is skipped entirely */
+	template<typename F>
+	void for_each_active(F f) const
+	{
+		for(size_t i = 0; i < brick_count; ++i)
+		{
+			if(!m_bricks[i])
+				continue;
+
+			const brick_t& brick = *m_bricks[i];
+			for_each_voxel_in_brick(i, [&](const glm::uvec3& pos) {
+				f(pos, brick[voxel_index(pos)]);
+			});
+		}
+	}
+
+	template<typename F>
+	void for_each_active(F f)
+	{
+		for(size_t i = 0; i < brick_count; ++i)
+		{
+			if(!m_bricks[i])
+				continue;
+
+			brick_t& brick = *m_bricks[i];
+			for_each_voxel_in_brick(i, [&](const glm::uvec3& pos) {
+				f(pos, brick[voxel_index(pos)]);
+			});
+		}
+	}
+
+	/* Releases bricks that only contain the background value */
+	void compact()
+	{
+		for(auto& brick : m_bricks)
+		{
+			if(!brick)
+				continue;
+
+			bool empty = true;
+			for(const T& v : *brick)
+				if(!(v == m_background))
+				{
+					empty = false;
+					break;
+				}
+
+			if(empty)
+				brick.reset();
+		}
+	}
+
+	static sparse_volume from_dense(const volume<T, X, Y, Z>& v, const T background = T())
+	{
+		sparse_volume result(background);
+
+		for(size_t i = 0; i < brick_count; ++i)
+		{
+			bool empty = true;
+			for_each_voxel_in_brick(i, [&](const glm::uvec3& pos) {
+				empty = empty && v[pos] == background;
+			});
+
+			if(empty)
+				continue;
+
+			brick_t& brick = result.acquire_brick(i);
+			for_each_voxel_in_brick(i, [&](const glm::uvec3& pos) {
+				brick[voxel_index(pos)] = v[pos];
+			});
+		}
+
+		return result;
+	}
+
+	void to_dense(volume<T, X, Y, Z>& v) const
+	{
+		for(size_t i = 0; i < brick_count; ++i)
+		{
+			if(m_bricks[i])
+			{
+				const brick_t& brick = *m_bricks[i];
+				for_each_voxel_in_brick(i, [&](const glm::uvec3& pos) {
+					v[pos] = brick[voxel_index(pos)];
+				});
+			}
+			else
+				for_each_voxel_in_brick(i, [&](const glm::uvec3& pos) {
+					v[pos] = m_background;
+				});
+		}
+	}
+
+	volume<T, X, Y, Z> to_dense() const
+	{
+		volume<T, X, Y, Z> result;
+		to_dense(result);
+		return result;
+	}
+};
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gl/glm_include.hpp"
+
+/*
+ * Out-of-core volume: a file of fixed-size bricks plus an index, accessed through an LRU cache of bricks.
+ * Memory use is bounded by the cache capacity and the bricks pinned by callers, independent of the volume size.
+ *
+ * The file starts with a header and the index, one file offset per brick; bricks that were never written have offset 0
+ * and read as T(). Bricks are stored uncompressed in host byte order, so that a brick can be rewritten in place.
+ * Voxel order within a brick, and within the slabs passed to store_slab and load_slab, matches volume: x is the slowest axis.
+ */
+template<typename T, size_t X, size_t Y, size_t Z, size_t B = 32>
+class tiled_volume
+{
+public:
+	static constexpr size_t brick_size = B;
+	static constexpr size_t BX = (X + B - 1) / B, BY = (Y + B - 1) / B, BZ = (Z + B - 1) / B;
+	static constexpr size_t brick_count = BX*BY*BZ;
+	static constexpr size_t brick_bytes = B*B*B*sizeof(T);
+
+	typedef std::array<T, B*B*B> brick_t;
+
+private:
+	struct header_t
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t x, y, z;
+		uint32_t brick_size, voxel_size;
+		uint32_t reserved;
+	};
+
+	struct entry_t
+	{
+		std::shared_ptr<brick_t> brick;
+		std::list<size_t>::iterator lru;
+		bool dirty;
+	};
+
+	static constexpr uint32_t version = 1;
+	static constexpr off_t index_offset = sizeof(header_t);
+	static constexpr off_t data_offset = sizeof(header_t) + brick_count * sizeof(uint64_t);
+
+	std::string m_filename;
+	int m_fd;
+	std::vector<uint64_t> m_index;
+	bool m_index_dirty;
+	off_t m_end;
+
+	size_t m_capacity; // Bricks
+	std::list<size_t> m_lru; // Most recently used first
+	std::unordered_map<size_t, entry_t> m_cache;
+	std::mutex m_mutex;
+
+	tiled_volume(const tiled_volume&) = delete;
+	tiled_volume& operator=(const tiled_volume&) = delete;
+
+	void pread_all(char* data, size_t n, off_t offset) const
+	{
+		while(n > 0)
+		{
+			const ssize_t len = ::pread(m_fd, data, n, offset);
+			if(len <= 0)
+				throw std::runtime_error("Could not read " + m_filename);
+
+			data += len;
+			n -= len;
+			offset += len;
+		}
+	}
+
+	void pwrite_all(const char* data, size_t n, off_t offset) const
+	{
+		while(n > 0)
+		{
+			const ssize_t len = ::pwrite(m_fd, data, n, offset);
+			if(len <= 0)
+				throw std::runtime_error("Could not write " + m_filename);
+
+			data += len;
+			n -= len;
+			offset += len;
+		}
+	}
+
+	static bool is_empty(const brick_t& brick)
+	{
+		static const brick_t empty = brick_t();
+		return std::memcmp(brick.data(), empty.data(), brick_bytes) == 0;
+	}
+
+	/* Writes a brick back to its slot; empty bricks without a slot stay unallocated */
+	void write_back(const size_t i, const brick_t& brick)
+	{
+		if(m_index[i] == 0)
+		{
+			if(is_empty(brick))
+				return;
+
+			m_index[i] = m_end;
+			m_end += brick_bytes;
+			m_index_dirty = true;
+		}
+
+		pwrite_all((const char*)brick.data(), brick_bytes, m_index[i]);
+	}
+
+	/* Drops least recently used bricks until the cache fits; bricks still referenced by callers are kept */
+	void evict()
+	{
+		auto it = m_lru.end();
+		while(m_cache.size() > m_capacity && it != m_lru.begin())
+		{
+			--it;
+
+			entry_t& e = m_cache.at(*it);
+			if(e.brick.use_count() > 1)
+				continue;
+
+			if(e.dirty)
+				write_back(*it, *e.brick);
+
+			m_cache.erase(*it);
+			it = m_lru.erase(it);
+		}
+	}
+
+	/* Returns the cached brick, loading it first if needed; the caller must hold m_mutex */
+	entry_t& fetch(const size_t i)
+	{
+		auto found = m_cache.find(i);
+		if(found != m_cache.end())
+		{
+			m_lru.splice(m_lru.begin(), m_lru, found->second.lru);
+			return found->second;
+		}
+
+		std::shared_ptr<brick_t> brick = std::make_shared<brick_t>();
+		if(m_index[i] != 0)
+			pread_all((char*)brick->data(), brick_bytes, m_index[i]);
+
+		m_lru.push_front(i);
+		entry_t& e = m_cache[i];
+		e.brick = brick;
+		e.lru = m_lru.begin();
+		e.dirty = false;
+
+		evict();
+		return e;
+	}
+
+	void write_header()
+	{
+		header_t h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.magic, "NTVL", 4);
+		h.version = version;
+		h.x = X;
+		h.y = Y;
+		h.z = Z;
+		h.brick_size = B;
+		h.voxel_size = sizeof(T);
+
+		pwrite_all((const char*)&h, sizeof(h), 0);
+	}
+
+	void read_header()
+	{
+		header_t h;
+		pread_all((char*)&h, sizeof(h), 0);
+
+		if(std::memcmp(h.magic, "NTVL", 4) != 0 || h.version != version)
+			throw std::runtime_error(m_filename + " is not a tiled volume");
+
+		if(h.x != X || h.y != Y || h.z != Z || h.brick_size != B || h.voxel_size != sizeof(T))
+			throw std::runtime_error(m_filename + " was written for a different volume layout");
+	}
+
+	void flush_locked()
+	{
+		for(auto& c : m_cache)
+			if(c.second.dirty)
+			{
+				write_back(c.first, *c.second.brick);
+
+				// A pinned brick may still be written through its pin; it stays dirty until released
+				if(c.second.brick.use_count() == 1)
+					c.second.dirty = false;
+			}
+
+		if(m_index_dirty)
+		{
+			pwrite_all((const char*)m_index.data(), m_index.size() * sizeof(uint64_t), index_offset);
+			m_index_dirty = false;
+		}
+	}
+
+	/* Calls f(brick, x range) for every brick overlapping the x-planes [x_begin, x_end) */
+	template<typename F>
+	static void for_each_brick_in_slab(const size_t x_begin, const size_t x_end, F f)
+	{
+		for(size_t bx = x_begin / B; bx < (x_end + B - 1) / B; ++bx)
+			for(size_t by = 0; by < BY; ++by)
+				for(size_t bz = 0; bz < BZ; ++bz)
+					f(bx * BY * BZ + by * BZ + bz, std::max(x_begin, bx * B), std::min(x_end, (bx + 1) * B));
+	}
+
+	/* Calls f(brick voxel index, slab voxel index) for the voxels of brick i with x in [x0, x1), for a slab starting at x_begin */
+	template<typename F>
+	static void for_each_slab_voxel(const size_t i, const size_t x0, const size_t x1, const size_t x_begin, F f)
+	{
+		const glm::uvec3 origin = brick_origin(i), end = brick_end(i);
+
+		for(size_t x = x0; x < x1; ++x)
+			for(size_t y = origin.y; y < end.y; ++y)
+			{
+				const size_t b = (x % B) * B * B + (y % B) * B;
+				const size_t s = (x - x_begin) * Y * Z + y * Z;
+
+				for(size_t z = origin.z; z < end.z; ++z)
+					f(b + z % B, s + z);
+			}
+	}
+
+public:
+	static size_t brick_index(const glm::uvec3& pos)
+	{
+		return (pos.x / B) * BY * BZ + (pos.y / B) * BZ + (pos.z / B);
+	}
+
+	static size_t voxel_index(const glm::uvec3& pos)
+	{
+		return (pos.x % B) * B * B + (pos.y % B) * B + (pos.z % B);
+	}
+
+	static glm::uvec3 brick_origin(const size_t brick)
+	{
+		return glm::uvec3(
+			(brick / (BY * BZ)) * B,
+			((brick / BZ) % BY) * B,
+			(brick % BZ) * B
+		);
+	}
+
+	/* One past the last voxel of a brick, clipped to the volume bounds */
+	static glm::uvec3 brick_end(const size_t brick)
+	{
+		return glm::min(brick_origin(brick) + glm::uvec3(B), glm::uvec3(X, Y, Z));
+	}
+
+	/* Opens filename, or creates an empty volume if it does not exist; cache_bytes bounds the memory held by cached bricks */
+	tiled_volume(const std::string& filename, const size_t cache_bytes)
+	: m_filename(filename)
+	, m_fd(::open(filename.c_str(), O_RDWR | O_CREAT, 0644))
+	, m_index(brick_count, 0)
+	, m_index_dirty(false)
+	, m_end(data_offset)
+	, m_capacity(std::max<size_t>(1, cache_bytes / brick_bytes))
+	, m_lru()
+	, m_cache()
+	, m_mutex()
+	{
+		if(m_fd < 0)
+			throw std::runtime_error("Could not open " + filename);
+
+		const off_t size = ::lseek(m_fd, 0, SEEK_END);
+		if(size == 0)
+		{
+			write_header();
+			m_index_dirty = true;
+		}
+		else
+		{
+			read_header();
+			pread_all((char*)m_index.data(), m_index.size() * sizeof(uint64_t), index_offset);
+			m_end = std::max<off_t>(size, data_offset);
+		}
+	}
+
+	~tiled_volume()
+	{
+		try
+		{
+			flush();
+		} catch(const std::exception& e)
+		{
+			std::cerr << "Could not flush " << m_filename << ": " << e.what() << std::endl;
+		}
+
+		::close(m_fd);
+	}
+
+	/* Pins a brick for reading; pinned bricks are not evicted */
+	std::shared_ptr<const brick_t> read_brick(const size_t i)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return fetch(i).brick;
+	}
+
+	/* Pins a brick for writing; it is written back when it is evicted or flushed after the caller released it */
+	std::shared_ptr<brick_t> write_brick(const size_t i)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry_t& e = fetch(i);
+		e.dirty = true;
+		return e.brick;
+	}
+
+	T get(const glm::uvec3& pos)
+	{
+		return (*read_brick(brick_index(pos)))[voxel_index(pos)];
+	}
+
+	void set(const glm::uvec3& pos, const T& value)
+	{
+		(*write_brick(brick_index(pos)))[voxel_index(pos)] = value;
+	}
+
+	/* Stores the x-planes [x_begin, x_end), laid out as in volume starting at plane x_begin */
+	void store_slab(const T* data, const size_t x_begin, const size_t x_end)
+	{
+		for_each_brick_in_slab(x_begin, x_end, [&](const size_t i, const size_t x0, const size_t x1) {
+			const std::shared_ptr<brick_t> brick = write_brick(i);
+			for_each_slab_voxel(i, x0, x1, x_begin, [&](const size_t b, const size_t s) {
+				(*brick)[b] = data[s];
+			});
+		});
+	}
+
+	void load_slab(T* data, const size_t x_begin, const size_t x_end)
+	{
+		for_each_brick_in_slab(x_begin, x_end, [&](const size_t i, const size_t x0, const size_t x1) {
+			const std::shared_ptr<const brick_t> brick = read_brick(i);
+			for_each_slab_voxel(i, x0, x1, x_begin, [&](const size_t b, const size_t s) {
+				data[s] = (*brick)[b];
+			});
+		});
+	}
+
+	/* Hints that the bricks overlapping [begin, end) will be read soon, so that the OS reads them ahead */
+	void prefetch(const glm::uvec3& begin, const glm::uvec3& end)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for(size_t x = begin.x / B * B; x < end.x; x += B)
+			for(size_t y = begin.y / B * B; y < end.y; y += B)
+				for(size_t z = begin.z / B * B; z < end.z; z += B)
+				{
+					const size_t i = brick_index(glm::uvec3(x, y, z));
+					if(m_index[i] != 0 && m_cache.find(i) == m_cache.end())
+						::posix_fadvise(m_fd, m_index[i], brick_bytes, POSIX_FADV_WILLNEED);
+				}
+	}
+
+	/* Writes all dirty bricks and the index to the file */
+	void flush()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		flush_locked();
+	}
+
+	size_t cached_bricks()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_cache.size();
+	}
+
+	size_t allocated_bricks()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return std::count_if(m_index.begin(), m_index.end(), [](const uint64_t offset) { return offset != 0; });
+	}
+};
+
+template<typename T, size_t X, size_t Y, size_t Z, size_t B>
+constexpr uint32_t tiled_volume<T, X, Y, Z, B>::version;
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+
+#include <zlib.h>
+
+#include "parallel.hpp"
+
+/*
+ * Block-compressed container; the stream is cut into fixed-size blocks which are deflated independently,
+ * so that both directions run on all cores and any byte range can be read without inflating the rest.
+ *
+ * Layout (integers little endian):
+ *   header  "NBLK" | u32 version | u32 block size
+ *   blocks  zlib streams, back to back
+ *   index   per block: u64 file offset | u32 compressed size | u32 raw size
+ *   footer  u64 index offset | u64 block count | "NBLK"
+ */
+/* Set in code only; the command line always writes with the defaults */
+struct block_codec_options
+{
+	int level = Z_DEFAULT_COMPRESSION;
+	size_t block_size = 4*1024*1024;
+};
+
+namespace block_format
+{
+	static const char magic[4] = {'N', 'B', 'L', 'K'};
+	static constexpr uint32_t version = 1;
+	static constexpr size_t header_size = 12, entry_size = 16, footer_size = 20;
+
+	struct entry_t
+	{
+		uint64_t offset;
+		uint32_t compressed_size, raw_size;
+	};
+
+	static inline void put(char* p, uint64_t x, const size_t bytes)
+	{
+		for(size_t i = 0; i < bytes; ++i, x >>= 8)
+			p[i] = (char)(x & 0xff);
+	}
+
+	static inline uint64_t get(const char* p, const size_t bytes)
+	{
+		uint64_t x = 0;
+		for(size_t i = bytes; i-- > 0;)
+			x = (x << 8) | (uint8_t)p[i];
+		return x;
+	}
+
+	/* Number of blocks processed at once; bounds memory to a few blocks per core */
+	static inline size_t batch_size()
+	{
+		return std::max<size_t>(std::thread::hardware_concurrency(), 1) * 2;
+	}
+}
+
+class block_writer
+{
+	struct block_t
+	{
+		std::vector<char> raw, compressed;
+	};
+
+	std::string m_filename;
+	std::ofstream m_fo;
+	block_codec_options m_opt;
+	std::vector<block_t> m_batch;
+	size_t m_filled; // Blocks in m_batch that are complete or in progress
+	uint64_t m_offset;
+	std::vector<block_format::entry_t> m_index;
+	bool m_closed;
+
+	block_writer(const block_writer&) = delete;
+	block_writer& operator=(const block_writer&) = delete;
+
+	/* A full disk or I/O error fails the stream; the file must not pass for complete then */
+	void check_stream()
+	{
+		if(!m_fo)
+			throw std::runtime_error("Failed to write " + m_filename);
+	}
+
+	void flush_batch()
+	{
+		if(m_filled == 0)
+			return;
+
+		const int level = m_opt.level;
+		std::vector<block_t>& batch = m_batch;
+		parallel_for(0, m_filled, [&batch, level](const size_t i) {
+			block_t& b = batch[i];
+			uLongf len = compressBound(b.raw.size());
+			b.compressed.resize(len);
+
+			if(compress2((Bytef*)b.compressed.data(), &len, (const Bytef*)b.raw.data(), b.raw.size(), level) != Z_OK)
+				throw std::runtime_error("Block compression failed");
+
+			b.compressed.resize(len);
+		});
+
+		for(size_t i = 0; i < m_filled; ++i)
+		{
+			block_t& b = m_batch[i];
+			m_fo.write(b.compressed.data(), b.compressed.size());
+			m_index.push_back({m_offset, (uint32_t)b.compressed.size(), (uint32_t)b.raw.size()});
+			m_offset += b.compressed.size();
+			b.raw.clear();
+		}
+
+		check_stream();
+		m_filled = 0;
+	}
+
+public:
+	block_writer(const std::string& filename, const block_codec_options& opt = block_codec_options())
+	: m_filename(filename)
+	, m_fo(filename, std::ios_base::binary)
+	, m_opt(opt)
+	, m_batch(block_format::batch_size())
+	, m_filled(0)
+	, m_offset(block_format::header_size)
+	, m_index()
+	, m_closed(false)
+	{
+		if(!m_fo)
+			throw std::runtime_error("Could not open " + filename + " for writing");
+
+		if(m_opt.block_size == 0 || m_opt.block_size > UINT32_MAX)
+			throw std::invalid_argument("Invalid block size");
+
+		char header[block_format::header_size];
+		std::memcpy(header, block_format::magic, 4);
+		block_format::put(header + 4, block_format::version, 4);
+		block_format::put(header + 8, m_opt.block_size, 4);
+		m_fo.write(header, sizeof(header));
+		check_stream();
+	}
+
+	~block_writer()
+	{
+		try
+		{
+			close();
+		} catch(...)
+		{} // Call close() explicitly to observe errors
+	}
+
+	void write(const char* data, size_t n)
+	{
+		while(n > 0)
+		{
+			if(m_filled == m_batch.size())
+				flush_batch();
+
+			std::vector<char>& raw = m_batch[m_filled].raw;
+			raw.reserve(m_opt.block_size);
+
+			const size_t len = std::min(n, m_opt.block_size - raw.size());
+			raw.insert(raw.end(), data, data + len);
+			data += len;
+			n -= len;
+
+			if(raw.size() == m_opt.block_size)
+				++m_filled;
+		}
+	}
+
+	/* Compresses the remaining data and writes the index; the file is incomplete until this is called */
+	void close()
+	{
+		if(m_closed)
+			return;
+
+		m_closed = true;
+
+		if(m_filled < m_batch.size() && !m_batch[m_filled].raw.empty())
+			++m_filled;
+
+		flush_batch();
+
+		std::vector<char> index(m_index.size() * block_format::entry_size + block_format::footer_size);
+		char* p = index.data();
+		for(const block_format::entry_t& e : m_index)
+		{
+			block_format::put(p, e.offset, 8);
+			block_format::put(p + 8, e.compressed_size, 4);
+			block_format::put(p + 12, e.raw_size, 4);
+			p += block_format::entry_size;
+		}
+
+		block_format::put(p, m_offset, 8);
+		block_format::put(p + 8, m_index.size(), 8);
+		std::memcpy(p + 16, block_format::magic, 4);
+
+		m_fo.write(index.data(), index.size());
+		check_stream();
+
+		m_fo.close();
+		check_stream();
+	}
+};
+
+class block_reader
+{
+	std::ifstream m_fi;
+	size_t m_block_size;
+	std::vector<block_format::entry_t> m_index;
+	uint64_t m_raw_size;
+
+	// Sequential reads inflate a batch of blocks ahead, in parallel
+	std::vector<std::vector<char>> m_ahead;
+	size_t m_ahead_first, m_ahead_count;
+	uint64_t m_position;
+
+	block_reader(const block_reader&) = delete;
+	block_reader& operator=(const block_reader&) = delete;
+
+	/* Inflates blocks [first, first + count) into out; file access is serialized, inflation is not */
+	void inflate_blocks(const size_t first, const size_t count, std::vector<std::vector<char>>& out)
+	{
+		std::vector<std::vector<char>> compressed(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			const block_format::entry_t& e = m_index[first + i];
+			compressed[i].resize(e.compressed_size);
+			m_fi.seekg(e.offset);
+			m_fi.read(compressed[i].data(), e.compressed_size);
+		}
+
+		if(!m_fi)
+			throw std::runtime_error("Truncated block file");
+
+		out.resize(std::max(out.size(), count));
+		const std::vector<block_format::entry_t>& index = m_index;
+		parallel_for(0, count, [&](const size_t i) {
+			const block_format::entry_t& e = index[first + i];
+			out[i].resize(e.raw_size);
+
+			uLongf len = e.raw_size;
+			if(uncompress((Bytef*)out[i].data(), &len, (const Bytef*)compressed[i].data(), e.compressed_size) != Z_OK || len != e.raw_size)
+				throw std::runtime_error("Corrupt block");
+		});
+	}
+
+public:
+	block_reader(const std::string& filename)
+	: m_fi(filename, std::ios_base::binary)
+	, m_block_size(0)
+	, m_index()
+	, m_raw_size(0)
+	, m_ahead()
+	, m_ahead_first(0)
+	, m_ahead_count(0)
+	, m_position(0)
+	{
+		char header[block_format::header_size];
+		if(!m_fi.read(header, sizeof(header)) || std::memcmp(header, block_format::magic, 4) != 0)
+			throw std::runtime_error("Not a block file: " + filename);
+
+		if(block_format::get(header + 4, 4) != block_format::version)
+			throw std::runtime_error("Unsupported block file version: " + filename);
+
+		m_block_size = block_format::get(header + 8, 4);
+		if(m_block_size == 0)
+			throw std::runtime_error("Corrupt block file header: " + filename);
+
+		m_fi.seekg(0, std::ios_base::end);
+		const uint64_t file_size = m_fi.tellg();
+
+		char footer[block_format::footer_size];
+		if(file_size < block_format::header_size + block_format::footer_size
+			|| !m_fi.seekg(file_size - block_format::footer_size)
+			|| !m_fi.read(footer, sizeof(footer))
+			|| std::memcmp(footer + 16, block_format::magic, 4) != 0)
+			throw std::runtime_error("Incomplete block file: " + filename);
+
+		// The index ends where the footer starts; checked before count sizes any allocation
+		const uint64_t index_offset = block_format::get(footer, 8);
+		const uint64_t count = block_format::get(footer + 8, 8);
+		const uint64_t index_end = file_size - block_format::footer_size;
+
+		if(index_offset < block_format::header_size || index_offset > index_end
+			|| (index_end - index_offset) % block_format::entry_size != 0 || count != (index_end - index_offset) / block_format::entry_size)
+			throw std::runtime_error("Corrupt block index: " + filename);
+
+		std::vector<char> index(count * block_format::entry_size);
+		m_fi.seekg(index_offset);
+		if(!m_fi.read(index.data(), index.size()))
+			throw std::runtime_error("Truncated block index: " + filename);
+
+		m_index.resize(count);
+		for(size_t i = 0; i < count; ++i)
+		{
+			const char* p = index.data() + i * block_format::entry_size;
+			const block_format::entry_t e = {block_format::get(p, 8), (uint32_t)block_format::get(p + 8, 4), (uint32_t)block_format::get(p + 12, 4)};
+
+			// Every block but the last is full, which reads rely on to find blocks
+			if(e.offset < block_format::header_size || e.offset > index_offset || e.compressed_size > index_offset - e.offset
+				|| e.raw_size > m_block_size || (i + 1 < count && e.raw_size != m_block_size))
+				throw std::runtime_error("Corrupt block index: " + filename);
+
+			m_index[i] = e;
+			m_raw_size += e.raw_size;
+		}
+	}
+
+	static bool is_block_file(const std::string& filename)
+	{
+		std::ifstream fi(filename, std::ios_base::binary);
+		char magic[4];
+		return fi.read(magic, 4) && std::memcmp(magic, block_format::magic, 4) == 0;
+	}
+
+	uint64_t raw_size() const
+	{
+		return m_raw_size;
+	}
+
+	/* Sequential read; returns the number of bytes read, 0 at the end */
+	size_t read(char* dst, const size_t n)
+	{
+		size_t done = 0;
+		while(done < n && m_position < m_raw_size)
+		{
+			const size_t block = m_position / m_block_size;
+
+			if(block < m_ahead_first || block >= m_ahead_first + m_ahead_count)
+			{
+				m_ahead_first = block;
+				m_ahead_count = std::min(block_format::batch_size(), m_index.size() - block);
+				inflate_blocks(m_ahead_first, m_ahead_count, m_ahead);
+			}
+
+			const std::vector<char>& raw = m_ahead[block - m_ahead_first];
+			const size_t offset = m_position - block * m_block_size;
+			const size_t len = std::min(n - done, raw.size() - offset);
+
+			std::memcpy(dst + done, raw.data() + offset, len);
+			done += len;
+			m_position += len;
+		}
+
+		return done;
+	}
+
+	/* Random access to [offset, offset + n) of the uncompressed stream; only the covering blocks are inflated */
+	void read_range(const uint64_t offset, const size_t n, char* dst)
+	{
+		if(offset + n > m_raw_size)
+			throw std::out_of_range("Read past the end of a block file");
+
+		if(n == 0)
+			return;
+
+		const size_t first = offset / m_block_size;
+		const size_t last = (offset + n - 1) / m_block_size;
+
+		std::vector<std::vector<char>> blocks;
+		inflate_blocks(first, last - first + 1, blocks);
+
+		size_t done = 0;
+		for(size_t b = first; b <= last; ++b)
+		{
+			const std::vector<char>& raw = blocks[b - first];
+			const size_t begin = b == first ? offset - first * m_block_size : 0;
+			const size_t len = std::min(n - done, raw.size() - begin);
+
+			std::memcpy(dst + done, raw.data() + begin, len);
+			done += len;
+		}
+	}
+};
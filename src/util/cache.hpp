@@ -1,10 +1,115 @@
 #pragma once
 
+#include <iostream>
 #include <functional>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 #include <boost/filesystem.hpp>
 
 #include "msgpackreader.hpp"
 #include "msgpackwriter.hpp"
+#include "trace.hpp"
+
+/* Background thread that writes generated results to disk; pending writes are finished before the program exits */
+class cache_writer
+{
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::deque<std::function<void()>> m_jobs;
+	size_t m_queued, m_written; // Writes ever queued and finished; jobs run in order, so write k is done once m_written >= k
+	bool m_busy, m_stop;
+	std::thread m_thread;
+
+	cache_writer()
+	: m_mutex()
+	, m_cv()
+	, m_jobs()
+	, m_queued(0)
+	, m_written(0)
+	, m_busy(false)
+	, m_stop(false)
+	, m_thread([this]() { run(); })
+	{}
+
+	cache_writer(const cache_writer&) = delete;
+	cache_writer& operator=(const cache_writer&) = delete;
+
+	void run()
+	{
+		trace::name_thread("cache writer");
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while(true)
+		{
+			m_cv.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+
+			if(m_jobs.empty())
+				return;
+
+			std::function<void()> job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			m_busy = true;
+
+			lock.unlock();
+			job();
+			job = nullptr; // Releases the written data before the write counts as done
+			lock.lock();
+
+			m_busy = false;
+			++m_written;
+			m_cv.notify_all();
+		}
+	}
+
+public:
+	~cache_writer()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+
+		m_cv.notify_all();
+		m_thread.join();
+	}
+
+	static cache_writer& instance()
+	{
+		static cache_writer writer;
+		return writer;
+	}
+
+	/* Queues a write; returns its ticket for wait() */
+	size_t enqueue(const std::function<void()>& job)
+	{
+		size_t ticket;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(job);
+			ticket = ++m_queued;
+		}
+
+		m_cv.notify_all();
+		return ticket;
+	}
+
+	/* Blocks until the write with the given ticket, and every write queued before it, is on disk and its data released */
+	void wait(const size_t ticket)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this, ticket]() { return m_written >= ticket; });
+	}
+
+	/* Blocks until all queued writes are on disk */
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [this]() { return m_jobs.empty() && !m_busy; });
+	}
+};
 
 template<typename T>
 class cache
@@ -15,20 +120,66 @@ private:
 	cache& operator=(cache&) = delete;
 
 public:
-	static T acquire(const std::string& filename, std::function<T()> generate_callback)
+	/*
+	 * Writes to a temporary file next to filename and renames it into place, so that readers never see a partial cache;
+	 * an existing cache is replaced. Returns false, after reporting why, if the file could not be written.
+	 */
+	static bool write(const std::string& filename, const T& x, const block_codec_options& opt = block_codec_options())
+	{
+		const std::string zone_name = "write " + filename;
+		trace::zone zone(zone_name);
+
+		const boost::filesystem::path target(filename);
+		const boost::filesystem::path tmp = boost::filesystem::unique_path(target.string() + ".%%%%-%%%%.tmp");
+
+		try
+		{
+			{
+				MsgpackWriter<T> writer(tmp.string(), opt);
+				writer.write(x);
+				writer.close(); // Throws unless every byte reached the file
+			}
+
+			// Only a complete file is published
+			boost::filesystem::rename(tmp, target);
+			return true;
+		} catch(const std::exception& e)
+		{
+			boost::system::error_code ec;
+			boost::filesystem::remove(tmp, ec);
+
+			std::cerr << "Could not write cache " << filename << ": " << e.what() << std::endl;
+			return false;
+		}
+	}
+
+	/*
+	 * Loads filename, or generates the result and returns it right away while cache_writer stores it in the background.
+	 * The result is shared with the writer and must therefore not be modified; copy it to derive from it.
+	 * If given, ticket receives the cache_writer ticket of the write, and is left alone when the file was loaded.
+	 */
+	static std::shared_ptr<const T> acquire(const std::string& filename, std::function<T()> generate_callback, const block_codec_options& opt = block_codec_options(), size_t* ticket = nullptr)
 	{
 		if(boost::filesystem::exists(filename))
 		{
+			const std::string zone_name = "read " + filename;
+			trace::zone zone(zone_name);
+
 			MsgpackReader<T> reader(filename);
-			T result;
-			reader.read(result);
+			std::shared_ptr<T> result = std::make_shared<T>();
+			reader.read(*result);
 			return result;
 		}
 		else
 		{
-			T result = generate_callback();
-			MsgpackWriter<T> writer(filename);
-			writer.write(result);
+			std::shared_ptr<const T> result = std::make_shared<T>(generate_callback());
+			const size_t queued = cache_writer::instance().enqueue([filename, result, opt]() {
+				write(filename, *result, opt);
+			});
+
+			if(ticket)
+				*ticket = queued;
+
 			return result;
 		}
 	}
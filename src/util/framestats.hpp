@@ -0,0 +1,324 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <iterator>
+
+/*
+ * Timings of the last frames, kept in a ring buffer. Percentiles and the frame time histogram are computed over the
+ * buffered frames on request; a summary is printed every report interval, so that recording a frame does no I/O.
+ */
+class frame_stats
+{
+public:
+	/* Seconds spent in each part of a frame; frame is the whole frame, including the buffer swap */
+	struct sample_t
+	{
+		double input, update, draw, swap, frame;
+	};
+
+	typedef double sample_t::*field_t;
+
+	struct summary_t
+	{
+		double mean, p50, p95, p99, max;
+	};
+
+private:
+	/* GPU time of a render pass in the last frames it was timed in */
+	struct gpu_series_t
+	{
+		std::vector<double> values;
+		size_t count;
+	};
+
+	std::vector<sample_t> m_samples;
+	size_t m_count; // Frames ever added
+	std::map<std::string, gpu_series_t> m_gpu;
+	double m_report_interval; // Seconds between summaries, 0 to disable them
+	double m_since_report;
+	size_t m_frames_since_report;
+
+	struct named_field_t
+	{
+		const char* name;
+		field_t field;
+	};
+
+	static const std::vector<named_field_t>& fields()
+	{
+		static const std::vector<named_field_t> f = {
+			{"input", &sample_t::input},
+			{"update", &sample_t::update},
+			{"draw", &sample_t::draw},
+			{"swap", &sample_t::swap},
+			{"frame", &sample_t::frame}
+		};
+
+		return f;
+	}
+
+	/* Most recent sample first */
+	const sample_t& recent(const size_t i) const
+	{
+		return m_samples[(m_count - 1 - i) % m_samples.size()];
+	}
+
+	static double percentile(std::vector<double>& values, const double p)
+	{
+		const size_t i = std::min(values.size() - 1, (size_t)(p * values.size()));
+		std::nth_element(values.begin(), values.begin() + i, values.end());
+		return values[i];
+	}
+
+	static summary_t summarize(std::vector<double>& values)
+	{
+		if(values.empty())
+			return {0.0, 0.0, 0.0, 0.0, 0.0};
+
+		summary_t s;
+		s.mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+		s.max = *std::max_element(values.begin(), values.end());
+		s.p50 = percentile(values, 0.50);
+		s.p95 = percentile(values, 0.95);
+		s.p99 = percentile(values, 0.99);
+		return s;
+	}
+
+	static void write_summary(std::ostream& os, const summary_t& s)
+	{
+		os << "{\"mean\": " << s.mean * 1000.0 << ", \"p50\": " << s.p50 * 1000.0
+			<< ", \"p95\": " << s.p95 * 1000.0 << ", \"p99\": " << s.p99 * 1000.0 << ", \"max\": " << s.max * 1000.0 << "}";
+	}
+
+public:
+	frame_stats(const size_t capacity = 4096, const double report_interval = 5.0)
+	: m_samples(std::max<size_t>(capacity, 1))
+	, m_count(0)
+	, m_gpu()
+	, m_report_interval(report_interval)
+	, m_since_report(0.0)
+	, m_frames_since_report(0)
+	{}
+
+	/* Resizes the buffer; drops the recorded frames */
+	void set_capacity(const size_t capacity)
+	{
+		m_samples.assign(std::max<size_t>(capacity, 1), sample_t());
+		m_count = 0;
+		m_gpu.clear();
+	}
+
+	void set_report_interval(const double seconds)
+	{
+		m_report_interval = seconds;
+	}
+
+	/* Frames held in the buffer */
+	size_t size() const
+	{
+		return std::min(m_count, m_samples.size());
+	}
+
+	/* Records a frame; prints a summary of the frames since the last one once the report interval has passed */
+	void add(const sample_t& s)
+	{
+		m_samples[m_count % m_samples.size()] = s;
+		++m_count;
+
+		++m_frames_since_report;
+		m_since_report += s.frame;
+
+		if(m_report_interval > 0.0 && m_since_report >= m_report_interval)
+		{
+			report(std::cerr, m_frames_since_report);
+			m_since_report = 0.0;
+			m_frames_since_report = 0;
+		}
+	}
+
+	/* Records the GPU time of a pass; GPU times arrive a few frames late, see gpu_timer */
+	void add_gpu(const std::string& pass, const double seconds)
+	{
+		auto it = m_gpu.find(pass);
+		if(it == m_gpu.end())
+			it = m_gpu.insert(std::make_pair(pass, gpu_series_t{std::vector<double>(m_samples.size()), 0})).first;
+
+		gpu_series_t& g = it->second;
+		g.values[g.count % g.values.size()] = seconds;
+		++g.count;
+	}
+
+	/* Statistics of field over the last n buffered frames */
+	summary_t summary(const field_t field, size_t n) const
+	{
+		n = std::min(n, size());
+
+		std::vector<double> values(n);
+		for(size_t i = 0; i < n; ++i)
+			values[i] = recent(i).*field;
+
+		return summarize(values);
+	}
+
+	summary_t summary(const field_t field) const
+	{
+		return summary(field, size());
+	}
+
+	/* Statistics of the GPU time of pass over its last n samples */
+	summary_t gpu_summary(const std::string& pass, size_t n) const
+	{
+		const auto it = m_gpu.find(pass);
+		if(it == m_gpu.end())
+			return {0.0, 0.0, 0.0, 0.0, 0.0};
+
+		const gpu_series_t& g = it->second;
+		n = std::min(n, std::min(g.count, g.values.size()));
+
+		std::vector<double> values(n);
+		for(size_t i = 0; i < n; ++i)
+			values[i] = g.values[(g.count - 1 - i) % g.values.size()];
+
+		return summarize(values);
+	}
+
+	/* Passes with GPU timings */
+	std::vector<std::string> gpu_passes() const
+	{
+		std::vector<std::string> passes;
+		for(const auto& g : m_gpu)
+			passes.push_back(g.first);
+
+		return passes;
+	}
+
+	/* Upper bounds in milliseconds of the frame time histogram buckets; the last bucket is unbounded */
+	static const std::vector<double>& bucket_bounds()
+	{
+		static const std::vector<double> bounds = {4.0, 8.0, 12.0, 16.7, 20.0, 25.0, 33.3, 50.0, 100.0};
+		return bounds;
+	}
+
+	/* Frame time histogram of the buffered frames; one more bucket than bucket_bounds */
+	std::vector<size_t> histogram() const
+	{
+		const std::vector<double>& bounds = bucket_bounds();
+		std::vector<size_t> counts(bounds.size() + 1, 0);
+
+		for(size_t i = 0; i < size(); ++i)
+		{
+			const double ms = recent(i).frame * 1000.0;
+			++counts[std::upper_bound(bounds.begin(), bounds.end(), ms) - bounds.begin()];
+		}
+
+		return counts;
+	}
+
+	/* Prints p50/p95/p99 in milliseconds of every timing over the last n frames */
+	void report(std::ostream& os, const size_t n) const
+	{
+		const summary_t frame = summary(&sample_t::frame, n);
+		const std::ios::fmtflags flags = os.flags();
+		const std::streamsize precision = os.precision();
+
+		os << std::fixed << std::setprecision(1) << (frame.mean > 0.0 ? 1.0 / frame.mean : 0.0) << " FPS over " << std::min(n, size()) << " frames (ms p50/p95/p99):";
+		for(const named_field_t& f : fields())
+		{
+			const summary_t s = summary(f.field, n);
+			os << " " << f.name << " " << std::setprecision(2) << s.p50 * 1000.0 << "/" << s.p95 * 1000.0 << "/" << s.p99 * 1000.0;
+		}
+
+		for(const auto& g : m_gpu)
+		{
+			const summary_t s = gpu_summary(g.first, n);
+			os << " gpu " << g.first << " " << s.p50 * 1000.0 << "/" << s.p95 * 1000.0 << "/" << s.p99 * 1000.0;
+		}
+
+		os << std::endl;
+		os.flags(flags);
+		os.precision(precision);
+	}
+
+	/* One row per buffered frame, oldest first, in milliseconds */
+	void write_csv(std::ostream& os) const
+	{
+		os << "frame";
+		for(const named_field_t& f : fields())
+			os << "," << f.name << "_ms";
+		os << std::endl;
+
+		os << std::fixed << std::setprecision(4);
+		for(size_t i = size(); i > 0; --i)
+		{
+			os << m_count - i;
+			for(const named_field_t& f : fields())
+				os << "," << recent(i - 1).*f.field * 1000.0;
+			os << "\n";
+		}
+	}
+
+	/* Summaries of every timing, the GPU passes and the frame time histogram, in milliseconds */
+	void write_json(std::ostream& os) const
+	{
+		os << std::fixed << std::setprecision(4)
+			<< "{" << std::endl
+			<< "\t\"frames\": " << size() << "," << std::endl
+			<< "\t\"timings\": {" << std::endl;
+
+		for(size_t i = 0; i < fields().size(); ++i)
+		{
+			os << "\t\t\"" << fields()[i].name << "\": ";
+			write_summary(os, summary(fields()[i].field));
+			os << (i + 1 < fields().size() ? "," : "") << std::endl;
+		}
+
+		os << "\t}," << std::endl
+			<< "\t\"gpu\": {" << std::endl;
+
+		for(auto it = m_gpu.begin(); it != m_gpu.end(); ++it)
+		{
+			os << "\t\t\"" << it->first << "\": ";
+			write_summary(os, gpu_summary(it->first, it->second.values.size()));
+			os << (std::next(it) != m_gpu.end() ? "," : "") << std::endl;
+		}
+
+		os << "\t}," << std::endl
+			<< "\t\"histogram\": [" << std::endl;
+
+		const std::vector<double>& bounds = bucket_bounds();
+		const std::vector<size_t> counts = histogram();
+		for(size_t i = 0; i < counts.size(); ++i)
+		{
+			os << "\t\t{\"upper_ms\": ";
+			if(i < bounds.size())
+				os << bounds[i];
+			else
+				os << "null";
+			os << ", \"count\": " << counts[i] << "}" << (i + 1 < counts.size() ? "," : "") << std::endl;
+		}
+
+		os << "\t]" << std::endl
+			<< "}" << std::endl;
+	}
+
+	/* Writes JSON if filename ends in .json and CSV otherwise; returns false if the file could not be written */
+	bool write(const std::string& filename) const
+	{
+		std::ofstream os(filename);
+
+		const std::string ext = ".json";
+		if(filename.size() >= ext.size() && filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0)
+			write_json(os);
+		else
+			write_csv(os);
+
+		return (bool)os;
+	}
+};
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <type_traits>
+
+#include <sys/mman.h>
+
+/*
+ * Types for which all-zero memory is a valid default-constructed value.
+ * hugepage_allocator skips default construction for these, so that fresh pages are never touched before use.
+ */
+template<typename T>
+struct lazy_zero : std::integral_constant<bool, std::is_trivial<T>::value>
+{};
+
+/*
+ * Cache of large zeroed mappings, shared by all hugepage_allocators.
+ *
+ * Fresh mappings come from anonymous mmap: the kernel supplies zero pages on first touch, so a page lands on the
+ * NUMA node of the thread that first writes it. Released mappings have their pages dropped with MADV_DONTNEED and are
+ * kept up to a budget, to be handed out again to allocations of the same size; reuse saves the mmap and munmap, while
+ * zeroing stays lazy and pages are placed by first touch again.
+ */
+class page_arena
+{
+public:
+	static constexpr size_t huge_page = 2*1024*1024;
+
+private:
+	std::mutex m_mutex;
+	std::multimap<size_t, void*> m_free;
+	size_t m_cached;
+	size_t m_budget;
+
+	page_arena()
+	: m_mutex()
+	, m_free()
+	, m_cached(0)
+	, m_budget(1024*1024*1024)
+	{}
+
+	page_arena(const page_arena&) = delete;
+	page_arena& operator=(const page_arena&) = delete;
+
+	static size_t round_up(const size_t bytes)
+	{
+		return (bytes + huge_page - 1) / huge_page * huge_page;
+	}
+
+	/* Maps bytes aligned to a huge page, so that transparent huge pages can back the whole range */
+	static void* map(const size_t bytes)
+	{
+		const size_t padded = bytes + huge_page;
+		void* p = mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(p == MAP_FAILED)
+			throw std::bad_alloc();
+
+		const uintptr_t begin = (uintptr_t)p;
+		const uintptr_t aligned = (begin + huge_page - 1) / huge_page * huge_page;
+
+		if(aligned > begin)
+			munmap(p, aligned - begin);
+
+		if(begin + padded > aligned + bytes)
+			munmap((void*)(aligned + bytes), begin + padded - aligned - bytes);
+
+#ifdef MADV_HUGEPAGE
+		madvise((void*)aligned, bytes, MADV_HUGEPAGE);
+#endif
+
+		return (void*)aligned;
+	}
+
+	/* Returns the pages of a mapping to the kernel; the next touch of each page faults in a zero page */
+	static bool discard(void* p, const size_t bytes)
+	{
+		return madvise(p, bytes, MADV_DONTNEED) == 0;
+	}
+
+public:
+	static page_arena& instance()
+	{
+		static page_arena arena;
+		return arena;
+	}
+
+	/* Returns zeroed memory of at least bytes, aligned to a huge page */
+	void* acquire(const size_t bytes)
+	{
+		const size_t size = round_up(bytes);
+
+		void* p = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto it = m_free.find(size);
+			if(it != m_free.end())
+			{
+				p = it->second;
+				m_cached -= size;
+				m_free.erase(it);
+			}
+		}
+
+		if(!p)
+			return map(size);
+
+		return p;
+	}
+
+	void release(void* p, const size_t bytes)
+	{
+		const size_t size = round_up(bytes);
+
+		if(discard(p, size))
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(m_cached + size <= m_budget)
+			{
+				m_free.insert(std::make_pair(size, p));
+				m_cached += size;
+				return;
+			}
+		}
+
+		munmap(p, size);
+	}
+
+	/* Maximum number of bytes kept for reuse; lowering it releases the excess immediately */
+	void set_budget(const size_t budget)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_budget = budget;
+
+		while(m_cached > m_budget && !m_free.empty())
+		{
+			auto it = --m_free.end();
+			munmap(it->second, it->first);
+			m_cached -= it->first;
+			m_free.erase(it);
+		}
+	}
+
+	void trim()
+	{
+		set_budget(0);
+	}
+};
+
+/*
+ * Allocator for large volumes. Allocations of at least a huge page go through page_arena, smaller ones through calloc;
+ * either way memory arrives zeroed, and default construction of lazy_zero types is a no-op.
+ */
+template<typename T>
+class hugepage_allocator
+{
+public:
+	typedef T value_type;
+
+	hugepage_allocator() {}
+
+	template<typename U>
+	hugepage_allocator(const hugepage_allocator<U>&) {}
+
+	T* allocate(const size_t n)
+	{
+		const size_t bytes = n * sizeof(T);
+		if(bytes >= page_arena::huge_page)
+			return (T*)page_arena::instance().acquire(bytes);
+
+		void* p = std::calloc(n, sizeof(T));
+		if(!p)
+			throw std::bad_alloc();
+
+		return (T*)p;
+	}
+
+	void deallocate(T* p, const size_t n)
+	{
+		const size_t bytes = n * sizeof(T);
+		if(bytes >= page_arena::huge_page)
+			page_arena::instance().release(p, bytes);
+		else
+			std::free(p);
+	}
+
+	template<typename U>
+	void construct(U* p)
+	{
+		construct_default(p, lazy_zero<U>());
+	}
+
+	template<typename U, typename... Args>
+	void construct(U* p, Args&&... args)
+	{
+		::new((void*)p) U(std::forward<Args>(args)...);
+	}
+
+private:
+	template<typename U>
+	static void construct_default(U*, std::true_type)
+	{}
+
+	template<typename U>
+	static void construct_default(U* p, std::false_type)
+	{
+		::new((void*)p) U();
+	}
+};
+
+template<typename T, typename U>
+bool operator==(const hugepage_allocator<T>&, const hugepage_allocator<U>&)
+{
+	return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const hugepage_allocator<T>&, const hugepage_allocator<U>&)
+{
+	return false;
+}
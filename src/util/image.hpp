@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdint>
+#include <zlib.h>
+
+/* 8-bit RGB image, rows from top to bottom; written as PNG or binary PPM depending on the file extension */
+class rgb_image
+{
+	static void put_u32(std::vector<uint8_t>& out, const uint32_t x)
+	{
+		out.push_back(x >> 24);
+		out.push_back(x >> 16);
+		out.push_back(x >> 8);
+		out.push_back(x);
+	}
+
+	static void put_chunk(std::ostream& os, const char* type, const std::vector<uint8_t>& data)
+	{
+		std::vector<uint8_t> chunk;
+		put_u32(chunk, data.size());
+		chunk.insert(chunk.end(), type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+
+		// The CRC covers type and data
+		put_u32(chunk, crc32(crc32(0, Z_NULL, 0), chunk.data() + 4, chunk.size() - 4));
+		os.write((const char*)chunk.data(), chunk.size());
+	}
+
+	static bool has_extension(const std::string& filename, const std::string& ext)
+	{
+		return filename.size() >= ext.size() && filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0;
+	}
+
+public:
+	size_t width, height;
+	std::vector<uint8_t> data; // width * height * 3 bytes
+
+	rgb_image(const size_t width, const size_t height)
+	: width(width)
+	, height(height)
+	, data(width * height * 3, 0)
+	{}
+
+	uint8_t* pixel(const size_t x, const size_t y)
+	{
+		return data.data() + (y * width + x) * 3;
+	}
+
+	void flip_vertical()
+	{
+		const size_t row = width * 3;
+		for(size_t y = 0; y < height / 2; ++y)
+			std::swap_ranges(data.begin() + y * row, data.begin() + (y + 1) * row, data.begin() + (height - 1 - y) * row);
+	}
+
+	bool write_ppm(const std::string& filename) const
+	{
+		std::ofstream os(filename, std::ios::binary);
+		os << "P6\n" << width << " " << height << "\n255\n";
+		os.write((const char*)data.data(), data.size());
+		return (bool)os;
+	}
+
+	bool write_png(const std::string& filename) const
+	{
+		// Every row starts with its filter type, none
+		std::vector<uint8_t> raw;
+		raw.reserve(height * (width * 3 + 1));
+		for(size_t y = 0; y < height; ++y)
+		{
+			raw.push_back(0);
+			raw.insert(raw.end(), data.begin() + y * width * 3, data.begin() + (y + 1) * width * 3);
+		}
+
+		uLongf compressed_size = compressBound(raw.size());
+		std::vector<uint8_t> compressed(compressed_size);
+		if(compress2(compressed.data(), &compressed_size, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK)
+			return false;
+		compressed.resize(compressed_size);
+
+		std::vector<uint8_t> header;
+		put_u32(header, width);
+		put_u32(header, height);
+		header.push_back(8); // Bit depth
+		header.push_back(2); // Truecolor
+		header.push_back(0); // Deflate
+		header.push_back(0); // Adaptive filtering
+		header.push_back(0); // No interlace
+
+		std::ofstream os(filename, std::ios::binary);
+		os.write("\x89PNG\r\n\x1a\n", 8);
+		put_chunk(os, "IHDR", header);
+		put_chunk(os, "IDAT", compressed);
+		put_chunk(os, "IEND", std::vector<uint8_t>());
+		return (bool)os;
+	}
+
+	/* PNG for .png, PPM otherwise; returns false if the file could not be written */
+	bool write(const std::string& filename) const
+	{
+		return has_extension(filename, ".png") ? write_png(filename) : write_ppm(filename);
+	}
+};
+
+/* Path of frame i of a sequence, the number inserted before the extension: frames/frame_00012.png for frames/frame.png */
+inline std::string numbered_filename(const std::string& path, const size_t i)
+{
+	const size_t dot = path.find_last_of('.');
+	const size_t slash = path.find_last_of('/');
+	const size_t split = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? path.size() : dot;
+
+	std::ostringstream name;
+	name << path.substr(0, split) << "_" << std::setw(5) << std::setfill('0') << i << path.substr(split);
+	return name.str();
+}
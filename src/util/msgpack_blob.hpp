@@ -0,0 +1,173 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include <msgpack.hpp>
+
+/*
+ * Bulk encoding of arrays of plain vector types as a single msgpack raw blob, instead of one msgpack array per element.
+ * A blob is the array [version, element size, raw bytes...]; components are stored little endian.
+ *
+ * A raw holds at most 4 GiB - 1 bytes, so larger blobs are split into several raws of whole elements that readers
+ * concatenate. Blobs that fit a single raw are encoded as before.
+ *
+ * Types opt in by specializing blob_traits with the size of their scalar components (MSGPACK_BLOB_TYPE).
+ */
+template<typename T>
+struct blob_traits
+{
+	static constexpr bool enabled = false;
+};
+
+#define MSGPACK_BLOB_TYPE(T, COMPONENT_SIZE) \
+	template<> \
+	struct blob_traits<T> \
+	{ \
+		static constexpr bool enabled = true; \
+		static constexpr size_t component_size = COMPONENT_SIZE; \
+	};
+
+MSGPACK_BLOB_TYPE(float, 4)
+
+namespace msgpack_blob
+{
+	static constexpr uint32_t version = 1;
+	static constexpr size_t max_raw_size = std::numeric_limits<uint32_t>::max();
+
+	static inline bool host_little_endian()
+	{
+		const uint16_t x = 1;
+		uint8_t b;
+		std::memcpy(&b, &x, 1);
+		return b == 1;
+	}
+
+	/* Reverses the byte order of every component; only needed on big endian hosts */
+	static inline void swap_components(char* data, const size_t bytes, const size_t component_size)
+	{
+		for(size_t i = 0; i + component_size <= bytes; i += component_size)
+			std::reverse(data + i, data + i + component_size);
+	}
+
+	/* Writes one raw of a blob, byte swapped in chunks on big endian hosts */
+	template<typename Packer>
+	void pack_part(Packer& pk, const char* data, const size_t bytes, const size_t component_size)
+	{
+		pk.pack_raw(bytes);
+
+		if(host_little_endian() || component_size == 1)
+		{
+			pk.pack_raw_body(data, bytes);
+			return;
+		}
+
+		std::vector<char> buffer;
+		static constexpr size_t chunk = 1024*1024;
+		for(size_t i = 0; i < bytes; i += chunk)
+		{
+			const size_t len = std::min(chunk, bytes - i);
+			buffer.assign(data + i, data + i + len);
+			swap_components(buffer.data(), len, component_size);
+			pk.pack_raw_body(buffer.data(), len);
+		}
+	}
+
+	template<typename Packer, typename T>
+	void pack(Packer& pk, const T* data, const size_t n)
+	{
+		static_assert(blob_traits<T>::enabled, "Type is not registered with MSGPACK_BLOB_TYPE");
+		static_assert(sizeof(T) % blob_traits<T>::component_size == 0, "Type must consist of its components only");
+
+		const size_t bytes = n * sizeof(T);
+		const size_t part = max_raw_size / sizeof(T) * sizeof(T);
+		const size_t parts = std::max<size_t>(1, (bytes + part - 1) / part);
+
+		pk.pack_array(2 + parts);
+		pk.pack((uint32_t)version);
+		pk.pack((uint32_t)sizeof(T));
+
+		for(size_t offset = 0, i = 0; i < parts; ++i, offset += part)
+			pack_part(pk, (const char*)data + offset, std::min(part, bytes - offset), blob_traits<T>::component_size);
+	}
+
+	/* Whether o was written by pack; objects from before the blob encoding are plain arrays of elements */
+	template<typename T>
+	bool is_blob(const msgpack::object& o)
+	{
+		if(o.type != msgpack::type::ARRAY || o.via.array.size < 3 || o.via.array.ptr[0].type != msgpack::type::POSITIVE_INTEGER)
+			return false;
+
+		for(size_t i = 2; i < o.via.array.size; ++i)
+			if(o.via.array.ptr[i].type != msgpack::type::RAW)
+				return false;
+
+		return true;
+	}
+
+	/* Number of elements in a blob; throws when the blob does not hold elements of type T */
+	template<typename T>
+	size_t count(const msgpack::object& o)
+	{
+		if(o.via.array.ptr[0].as<uint32_t>() != version || o.via.array.ptr[1].as<uint32_t>() != sizeof(T))
+			throw msgpack::type_error();
+
+		size_t bytes = 0;
+		for(size_t i = 2; i < o.via.array.size; ++i)
+		{
+			const msgpack::object_raw& raw = o.via.array.ptr[i].via.raw;
+			if(raw.size % sizeof(T) != 0)
+				throw msgpack::type_error();
+
+			bytes += raw.size;
+		}
+
+		return bytes / sizeof(T);
+	}
+
+	template<typename T>
+	void unpack(const msgpack::object& o, T* data, const size_t n)
+	{
+		if(count<T>(o) != n)
+			throw msgpack::type_error();
+
+		char* dst = (char*)data;
+		for(size_t i = 2; i < o.via.array.size; ++i)
+		{
+			const msgpack::object_raw& raw = o.via.array.ptr[i].via.raw;
+			std::memcpy(dst, raw.ptr, raw.size);
+			dst += raw.size;
+		}
+
+		if(!host_little_endian())
+			swap_components((char*)data, n * sizeof(T), blob_traits<T>::component_size);
+	}
+
+	template<typename Packer, typename T, typename A>
+	void pack_vector(Packer& pk, const std::vector<T, A>& v)
+	{
+		pack(pk, v.data(), v.size());
+	}
+
+	template<typename T, typename A>
+	void unpack_vector(const msgpack::object& o, std::vector<T, A>& v)
+	{
+		if(is_blob<T>(o))
+		{
+			v.resize(count<T>(o));
+			unpack(o, v.data(), v.size());
+			return;
+		}
+
+		if(o.type != msgpack::type::ARRAY)
+			throw msgpack::type_error();
+
+		v.resize(o.via.array.size);
+		for(size_t i = 0; i < v.size(); ++i)
+			o.via.array.ptr[i].convert(&v[i]);
+	}
+}
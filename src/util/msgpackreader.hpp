@@ -9,80 +9,71 @@
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/operations.hpp>
 
+#include "blockstream.hpp"
+#include "msgpackstream.hpp"
+
 template<typename T>
 class MsgpackReader
 {
-	const static size_t BUFFERSIZE = 1024*1024*1024;
-
 	std::ifstream m_fi;
-	boost::iostreams::filtering_istream m_si;
-	msgpack::unpacker m_pac;
-	std::shared_ptr<msgpack::zone> m_zone;
+	boost::iostreams::filtering_istream m_si; // Files from before the block format are plain gzip streams
+	std::unique_ptr<block_reader> m_blocks;
+	msgpack_stream m_stream;
 
 	MsgpackReader(const MsgpackReader&) = delete;
 	MsgpackReader& operator=(const MsgpackReader&) = delete;
 
-	bool consume()
+	size_t consume(char* buffer, const size_t n)
 	{
-		m_pac.reserve_buffer(64*1024);
-
-		auto len = boost::iostreams::read(m_si, m_pac.buffer(), m_pac.buffer_capacity());
-
-		if(len <= 0)
-			return false;
+		if(m_blocks)
+			return m_blocks->read(buffer, n);
 
-		m_pac.buffer_consumed(len);
-
-		return true;
+		const std::streamsize len = boost::iostreams::read(m_si, buffer, n);
+		return len > 0 ? len : 0;
 	}
 
 public:
 
 	MsgpackReader(std::string filename)
-	: m_fi(filename, std::ios_base::binary)
+	: m_fi()
 	, m_si()
-	, m_pac(BUFFERSIZE) // We use large objects, which will fail to load if buffer is not big enough
-	, m_zone()
+	, m_blocks()
+	, m_stream([this](char* buffer, const size_t n) { return consume(buffer, n); })
 	{
+		if(block_reader::is_block_file(filename))
+		{
+			m_blocks.reset(new block_reader(filename));
+			return;
+		}
+
+		m_fi.open(filename, std::ios_base::binary);
 		m_si.push(boost::iostreams::gzip_decompressor());
 		m_si.push(m_fi);
 	}
 
 	~MsgpackReader()
 	{
+		if(m_blocks)
+			return;
+
 		boost::iostreams::close(m_si);
 		m_fi.close();
 	}
 
+	/* Decodes the next object straight into x; memory use is bounded by the stream window, not the message size */
 	bool read(T& x)
 	{
-		m_zone.reset(); // Destruct and release memory of previous value
-		msgpack::unpacked result;
-		if(!m_pac.next(&result))
-		{
-			if(!consume())
-				return false;
-
-			if(!m_pac.next(&result))
-				std::logic_error("Msgpack buffer should contain something now.");
-		}
-
-		msgpack::object obj = result.get();
+		if(m_stream.at_end())
+			return false;
 
 		try
 		{
-			obj.convert(&x); // Reference will live until next read call (see msgpack::zone, m_zone)
-		} catch(msgpack::type_error)
+			stream_unpack(m_stream, x);
+		} catch(const msgpack::type_error&)
 		{
-			throw std::runtime_error("Msgpack type problem. Might be a broken file; or that your object was too big.");
+			throw std::runtime_error("Msgpack type problem. Might be a broken file.");
 		}
 
-		auto tmp = result.zone();
-		m_zone.reset(tmp.release()); // Yield pointer to shared_ptr, release ownership
-
-		if(m_pac.message_size() > BUFFERSIZE)
-			throw std::runtime_error("Msgpack message is too large");
-
 		return true;
 	}
 };
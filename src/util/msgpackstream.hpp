@@ -0,0 +1,362 @@
+#pragma once
+
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include <msgpack.hpp>
+
+#include "msgpack_blob.hpp"
+
+/*
+ * Incremental msgpack decoder over a byte source, holding at most a small fixed window of encoded data.
+ *
+ * Types that are large enough to matter decode themselves through a msgpack_stream_unpack(stream) member and
+ * read blobs straight into their storage; everything else is captured object by object and converted with msgpack-c.
+ */
+class msgpack_stream
+{
+public:
+	typedef std::function<size_t(char*, size_t)> source_t; // Reads up to n bytes, returns 0 at the end
+
+	static constexpr size_t window_size = 1024*1024;
+
+private:
+	source_t m_source;
+	std::vector<char> m_window;
+	size_t m_begin, m_end;
+	std::vector<char> m_capture;
+
+	msgpack_stream(const msgpack_stream&) = delete;
+	msgpack_stream& operator=(const msgpack_stream&) = delete;
+
+	/* Makes sure at least n <= window_size bytes are buffered; returns false if the source ends first */
+	bool fill(const size_t n)
+	{
+		if(m_end - m_begin >= n)
+			return true;
+
+		std::memmove(m_window.data(), m_window.data() + m_begin, m_end - m_begin);
+		m_end -= m_begin;
+		m_begin = 0;
+
+		while(m_end < n)
+		{
+			const size_t len = m_source(m_window.data() + m_end, m_window.size() - m_end);
+			if(len == 0)
+				return false;
+
+			m_end += len;
+		}
+
+		return true;
+	}
+
+	void require(const size_t n)
+	{
+		if(!fill(n))
+			throw std::runtime_error("Unexpected end of msgpack stream");
+	}
+
+	uint64_t read_be(const size_t bytes)
+	{
+		require(bytes);
+
+		uint64_t x = 0;
+		for(size_t i = 0; i < bytes; ++i)
+			x = (x << 8) | (uint8_t)m_window[m_begin + i];
+
+		m_begin += bytes;
+		return x;
+	}
+
+	/* Appends n bytes to out */
+	void copy_bytes(std::vector<char>& out, const size_t n)
+	{
+		const size_t offset = out.size();
+		out.resize(offset + n);
+		read_bytes(out.data() + offset, n);
+	}
+
+	/* Appends the big endian length field of a header to out and returns its value */
+	uint64_t copy_length(std::vector<char>& out, const size_t bytes)
+	{
+		copy_bytes(out, bytes);
+
+		uint64_t x = 0;
+		for(size_t i = out.size() - bytes; i < out.size(); ++i)
+			x = (x << 8) | (uint8_t)out[i];
+
+		return x;
+	}
+
+public:
+	msgpack_stream(const source_t& source)
+	: m_source(source)
+	, m_window(window_size)
+	, m_begin(0)
+	, m_end(0)
+	, m_capture()
+	{}
+
+	bool at_end()
+	{
+		return !fill(1);
+	}
+
+	uint8_t peek(const size_t offset = 0)
+	{
+		require(offset + 1);
+		return m_window[m_begin + offset];
+	}
+
+	/* Copies n bytes out of the stream; large reads go from the source to dst directly */
+	void read_bytes(char* dst, size_t n)
+	{
+		const size_t buffered = std::min(n, m_end - m_begin);
+		std::memcpy(dst, m_window.data() + m_begin, buffered);
+		m_begin += buffered;
+		dst += buffered;
+		n -= buffered;
+
+		while(n > 0)
+		{
+			const size_t len = m_source(dst, n);
+			if(len == 0)
+				throw std::runtime_error("Unexpected end of msgpack stream");
+
+			dst += len;
+			n -= len;
+		}
+	}
+
+	uint32_t read_array_header()
+	{
+		const uint8_t b = read_be(1);
+
+		if((b & 0xf0) == 0x90)
+			return b & 0x0f;
+		if(b == 0xdc)
+			return read_be(2);
+		if(b == 0xdd)
+			return read_be(4);
+
+		throw msgpack::type_error();
+	}
+
+	uint64_t read_uint()
+	{
+		const uint8_t b = read_be(1);
+
+		if(b < 0x80)
+			return b;
+
+		switch(b)
+		{
+		case 0xcc: return read_be(1);
+		case 0xcd: return read_be(2);
+		case 0xce: return read_be(4);
+		case 0xcf: return read_be(8);
+		default: throw msgpack::type_error();
+		}
+	}
+
+	/* Length of a raw, str or bin object */
+	uint32_t read_raw_header()
+	{
+		const uint8_t b = read_be(1);
+
+		if((b & 0xe0) == 0xa0)
+			return b & 0x1f;
+
+		switch(b)
+		{
+		case 0xc4: case 0xd9: return read_be(1);
+		case 0xc5: case 0xda: return read_be(2);
+		case 0xc6: case 0xdb: return read_be(4);
+		default: throw msgpack::type_error();
+		}
+	}
+
+	/* Whether the next object was written by msgpack_blob::pack: an array of at least three elements starting with a version */
+	bool next_is_blob()
+	{
+		if(!fill(1))
+			return false;
+
+		size_t header;
+		const uint8_t a = peek(0);
+		if(a >= 0x93 && a <= 0x9f)
+			header = 1;
+		else if(a == 0xdc)
+			header = 3;
+		else
+			return false;
+
+		if(!fill(header + 1))
+			return false;
+
+		const uint8_t b = peek(header);
+		return b < 0x80 || b == 0xcc || b == 0xcd || b == 0xce;
+	}
+
+	/* Reads the header of a blob of elements of type T and returns the number of raws it is split into */
+	template<typename T>
+	size_t read_blob_header()
+	{
+		const uint32_t length = read_array_header();
+		if(length < 3 || read_uint() != msgpack_blob::version || read_uint() != sizeof(T))
+			throw msgpack::type_error();
+
+		return length - 2;
+	}
+
+	/* Reads the header of the next raw of a blob and returns the number of elements it holds */
+	template<typename T>
+	size_t read_blob_part()
+	{
+		const uint32_t bytes = read_raw_header();
+		if(bytes % sizeof(T) != 0)
+			throw msgpack::type_error();
+
+		return bytes / sizeof(T);
+	}
+
+	template<typename T>
+	void read_blob_body(T* data, const size_t n)
+	{
+		read_bytes((char*)data, n * sizeof(T));
+
+		if(!msgpack_blob::host_little_endian())
+			msgpack_blob::swap_components((char*)data, n * sizeof(T), blob_traits<T>::component_size);
+	}
+
+	/* Copies the encoding of the next complete object into out */
+	void capture(std::vector<char>& out)
+	{
+		out.clear();
+
+		for(uint64_t pending = 1; pending > 0; --pending)
+		{
+			const uint8_t b = read_be(1);
+			out.push_back(b);
+
+			if(b < 0x80 || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3)
+				continue;
+			else if((b & 0xf0) == 0x80)
+				pending += 2 * (b & 0x0f);
+			else if((b & 0xf0) == 0x90)
+				pending += b & 0x0f;
+			else if((b & 0xe0) == 0xa0)
+				copy_bytes(out, b & 0x1f);
+			else switch(b)
+			{
+			case 0xc4: case 0xd9: copy_bytes(out, copy_length(out, 1)); break;
+			case 0xc5: case 0xda: copy_bytes(out, copy_length(out, 2)); break;
+			case 0xc6: case 0xdb: copy_bytes(out, copy_length(out, 4)); break;
+			case 0xc7: copy_bytes(out, copy_length(out, 1) + 1); break; // ext: length, type, data
+			case 0xc8: copy_bytes(out, copy_length(out, 2) + 1); break;
+			case 0xc9: copy_bytes(out, copy_length(out, 4) + 1); break;
+			case 0xca: copy_bytes(out, 4); break;
+			case 0xcb: copy_bytes(out, 8); break;
+			case 0xcc: case 0xd0: copy_bytes(out, 1); break;
+			case 0xcd: case 0xd1: copy_bytes(out, 2); break;
+			case 0xce: case 0xd2: copy_bytes(out, 4); break;
+			case 0xcf: case 0xd3: copy_bytes(out, 8); break;
+			case 0xd4: copy_bytes(out, 2); break; // fixext: type, data
+			case 0xd5: copy_bytes(out, 3); break;
+			case 0xd6: copy_bytes(out, 5); break;
+			case 0xd7: copy_bytes(out, 9); break;
+			case 0xd8: copy_bytes(out, 17); break;
+			case 0xdc: pending += copy_length(out, 2); break;
+			case 0xdd: pending += copy_length(out, 4); break;
+			case 0xde: pending += 2 * copy_length(out, 2); break;
+			case 0xdf: pending += 2 * copy_length(out, 4); break;
+			default: throw msgpack::type_error();
+			}
+		}
+	}
+
+	/* Decodes the next object with msgpack-c; only the object itself is held in memory */
+	template<typename T>
+	void convert(T& x)
+	{
+		capture(m_capture);
+
+		msgpack::unpacked result;
+		msgpack::unpack(&result, m_capture.data(), m_capture.size());
+		result.get().convert(&x);
+	}
+};
+
+namespace detail
+{
+	template<typename T>
+	struct has_stream_unpack
+	{
+		template<typename U>
+		static std::true_type test(decltype(std::declval<U&>().msgpack_stream_unpack(std::declval<msgpack_stream&>()))*);
+
+		template<typename U>
+		static std::false_type test(...);
+
+		typedef decltype(test<T>(nullptr)) type;
+	};
+
+	template<typename T>
+	void stream_unpack(msgpack_stream& s, T& x, std::true_type)
+	{
+		x.msgpack_stream_unpack(s);
+	}
+
+	template<typename T>
+	void stream_unpack(msgpack_stream& s, T& x, std::false_type)
+	{
+		s.convert(x);
+	}
+
+	template<typename T, typename A>
+	bool stream_unpack_blob(msgpack_stream& s, std::vector<T, A>& v, std::true_type)
+	{
+		if(!s.next_is_blob())
+			return false;
+
+		v.clear();
+		for(size_t parts = s.read_blob_header<T>(); parts > 0; --parts)
+		{
+			const size_t offset = v.size(), n = s.read_blob_part<T>();
+			v.resize(offset + n);
+			s.read_blob_body(v.data() + offset, n);
+		}
+
+		return true;
+	}
+
+	template<typename T, typename A>
+	bool stream_unpack_blob(msgpack_stream&, std::vector<T, A>&, std::false_type)
+	{
+		return false;
+	}
+}
+
+template<typename T>
+void stream_unpack(msgpack_stream& s, T& x)
+{
+	detail::stream_unpack(s, x, typename detail::has_stream_unpack<T>::type());
+}
+
+/* Vectors are decoded element by element, or as a whole for blobs */
+template<typename T, typename A>
+void stream_unpack(msgpack_stream& s, std::vector<T, A>& v)
+{
+	if(detail::stream_unpack_blob(s, v, std::integral_constant<bool, blob_traits<T>::enabled>()))
+		return;
+
+	v.resize(s.read_array_header());
+	for(T& x : v)
+		stream_unpack(s, x);
+}
@@ -4,38 +4,32 @@
 #include <string>
 
 #include <msgpack.hpp>
-#include <boost/iostreams/filtering_stream.hpp>
-#include <boost/iostreams/filter/gzip.hpp>
+
+#include "blockstream.hpp"
 
 template<typename T>
 class MsgpackWriter
 {
-	std::ofstream m_fo;
-	boost::iostreams::filtering_ostream m_so;
-	msgpack::packer<std::ostream> m_pac;
+	block_writer m_bo;
+	msgpack::packer<block_writer> m_pac;
 
 	MsgpackWriter(const MsgpackWriter&) = delete;
 	MsgpackWriter& operator=(const MsgpackWriter&) = delete;
 
 public:
-	MsgpackWriter(std::string filename)
-	: m_fo(filename, std::ios_base::binary)
-	, m_so()
-	, m_pac(&m_so)
-	{
-		m_so.push(boost::iostreams::gzip_compressor());
-		m_so.push(m_fo);
-	}
+	MsgpackWriter(std::string filename, const block_codec_options& opt = block_codec_options())
+	: m_bo(filename, opt)
+	, m_pac(&m_bo)
+	{}
 
-	~MsgpackWriter()
+	void write(const T& x)
 	{
-		// Closing the buffers in order is very important (UB)
-		boost::iostreams::close(m_so);
-		m_fo.close();
+		m_pac.pack(x);
 	}
 
-	void write(const T& x)
+	/* Finishes the file; called by the destructor, but only an explicit call reports errors */
+	void close()
 	{
-		m_pac.pack(x);
+		m_bo.close();
 	}
 };
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "trace.hpp"
+
+/*
+ * Threads that parallel_for borrows when it is called on one of them, instead of starting threads of its own,
+ * so that data-parallel work inside the stages of a task_graph runs on the threads of the graph.
+ */
+class worker_pool
+{
+public:
+	virtual ~worker_pool() {}
+
+	virtual size_t size() const = 0;
+
+	/* Queues a job for any of the workers; it may run after the caller no longer waits for it */
+	virtual void submit(const std::function<void()>& job) = 0;
+
+	/* Pool the calling thread works for, if any */
+	static worker_pool*& current()
+	{
+		static thread_local worker_pool* pool = nullptr;
+		return pool;
+	}
+};
+
+namespace parallel_detail
+{
+	inline size_t worker_count()
+	{
+		const worker_pool* pool = worker_pool::current();
+		return pool ? pool->size() : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+
+	/*
+	 * Calls part(t) once for every t in [0, n), on the workers of the current pool or else on a thread each.
+	 * On a pool the caller takes every part no worker has started yet, so it never waits on busy workers; it returns
+	 * once all parts are done. part must not throw.
+	 */
+	template<typename F>
+	void fork_join(const size_t n, const F& part)
+	{
+		worker_pool* pool = worker_pool::current();
+		if(!pool)
+		{
+			std::vector<std::thread> threads;
+			threads.reserve(n);
+
+			for(size_t t = 0; t < n; ++t)
+				threads.emplace_back([t, &part]() { part(t); });
+
+			for(std::thread& t : threads)
+				t.join();
+
+			return;
+		}
+
+		struct state_t
+		{
+			std::atomic<size_t> next;
+			std::mutex mutex;
+			std::condition_variable cv;
+			size_t done;
+		};
+
+		// Shared with the queued jobs, which may only get to run after all parts are done; they then find none left
+		const std::shared_ptr<state_t> state = std::make_shared<state_t>();
+		state->next = 0;
+		state->done = 0;
+
+		const F* const p = &part;
+		const std::function<void()> run_parts = [state, p, n]() {
+			size_t t;
+			while((t = state->next++) < n)
+			{
+				(*p)(t);
+
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if(++state->done == n)
+					state->cv.notify_all();
+			}
+		};
+
+		for(size_t t = 1; t < std::min(n, pool->size()); ++t)
+			pool->submit(run_parts);
+
+		run_parts();
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->cv.wait(lock, [&state, n]() { return state->done == n; });
+	}
+}
+
+/*
+ * Calls f(i) for every i in [begin, end), split in contiguous chunks over the hardware threads, or over the workers
+ * of the pool of the calling thread.
+ * The first exception thrown by f is rethrown on the calling thread once all threads have finished.
+ */
+template<typename F>
+void parallel_for(const size_t begin, const size_t end, F f)
+{
+	if(end <= begin)
+		return;
+
+	const size_t count = end - begin;
+	const size_t thread_count = std::min<size_t>(parallel_detail::worker_count(), count);
+	const size_t chunk = (count + thread_count - 1) / thread_count;
+
+	std::mutex error_mutex;
+	std::exception_ptr error;
+
+	parallel_detail::fork_join((count + chunk - 1) / chunk, [begin, end, chunk, &f, &error_mutex, &error](const size_t c) {
+		const size_t chunk_begin = begin + c * chunk;
+		const size_t chunk_end = std::min(chunk_begin + chunk, end);
+		try
+		{
+			trace::zone zone("parallel_for");
+			for(size_t i = chunk_begin; i < chunk_end; ++i)
+				f(i);
+		} catch(...)
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if(!error)
+				error = std::current_exception();
+		}
+	});
+
+	if(error)
+		std::rethrow_exception(error);
+}
+
+/*
+ * Calls f(i) for every i in [begin, end), for items of uneven cost. Every thread starts on its own contiguous range and
+ * takes items from its front; a thread that runs out steals the back half of the range of another thread.
+ * The first exception thrown by f is rethrown on the calling thread, items not yet started are then skipped.
+ */
+template<typename F>
+void parallel_for_stealing(const size_t begin, const size_t end, F f)
+{
+	if(end <= begin)
+		return;
+
+	struct range_t
+	{
+		std::mutex mutex;
+		size_t begin, end;
+	};
+
+	const size_t count = end - begin;
+	const size_t thread_count = std::min<size_t>(parallel_detail::worker_count(), count);
+
+	std::vector<range_t> ranges(thread_count);
+	for(size_t t = 0; t < thread_count; ++t)
+	{
+		ranges[t].begin = begin + count * t / thread_count;
+		ranges[t].end = begin + count * (t + 1) / thread_count;
+	}
+
+	std::atomic<bool> failed(false);
+	std::mutex error_mutex;
+	std::exception_ptr error;
+
+	// Next item of thread t: from its own front, or else the back half of the first other range found non-empty
+	const auto take = [&ranges, thread_count](const size_t t, size_t& i) {
+		{
+			std::lock_guard<std::mutex> lock(ranges[t].mutex);
+			if(ranges[t].begin < ranges[t].end)
+			{
+				i = ranges[t].begin++;
+				return true;
+			}
+		}
+
+		for(size_t k = 1; k < thread_count; ++k)
+		{
+			range_t& victim = ranges[(t + k) % thread_count];
+
+			size_t stolen_begin, stolen_end;
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if(victim.begin >= victim.end)
+					continue;
+
+				stolen_end = victim.end;
+				stolen_begin = victim.end - (victim.end - victim.begin + 1) / 2;
+				victim.end = stolen_begin;
+			}
+
+			std::lock_guard<std::mutex> lock(ranges[t].mutex);
+			ranges[t].begin = stolen_begin + 1;
+			ranges[t].end = stolen_end;
+			i = stolen_begin;
+			return true;
+		}
+
+		return false;
+	};
+
+	parallel_detail::fork_join(thread_count, [&take, &f, &failed, &error_mutex, &error](const size_t t) {
+		trace::zone zone("parallel_for");
+
+		size_t i;
+		while(!failed && take(t, i))
+		{
+			try
+			{
+				f(i);
+			} catch(...)
+			{
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if(!error)
+					error = std::current_exception();
+				failed = true;
+			}
+		}
+	});
+
+	if(error)
+		std::rethrow_exception(error);
+}
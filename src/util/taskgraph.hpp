@@ -0,0 +1,176 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+
+#include "trace.hpp"
+#include "parallel.hpp"
+
+/*
+ * Set of stages with dependencies, executed on a pool of threads; a stage starts as soon as all of its inputs are done.
+ * Results are passed through variables captured by the stages, the dependencies order all accesses to them.
+ * The threads also serve as the worker_pool of the stages: a parallel_for within a stage runs on idle stage threads.
+ */
+class task_graph
+{
+public:
+	typedef size_t task_id;
+
+private:
+	struct task_t
+	{
+		std::string name;
+		std::function<void()> f;
+		std::vector<task_id> dependents;
+		size_t pending; // Inputs not yet done
+	};
+
+	std::vector<task_t> m_tasks;
+
+	/* Queues jobs of parallel_for; the workers run them before starting further stages */
+	class pool_t : public worker_pool
+	{
+		std::mutex& m_mutex;
+		std::condition_variable& m_cv;
+		std::deque<std::function<void()>>& m_jobs;
+		const size_t m_size;
+
+	public:
+		pool_t(std::mutex& mutex, std::condition_variable& cv, std::deque<std::function<void()>>& jobs, const size_t size)
+		: m_mutex(mutex)
+		, m_cv(cv)
+		, m_jobs(jobs)
+		, m_size(size)
+		{}
+
+		size_t size() const
+		{
+			return m_size;
+		}
+
+		void submit(const std::function<void()>& job)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_jobs.push_back(job);
+			}
+
+			m_cv.notify_one();
+		}
+	};
+
+	task_graph(const task_graph&) = delete;
+	task_graph& operator=(const task_graph&) = delete;
+
+public:
+	task_graph()
+	: m_tasks()
+	{}
+
+	task_id add(const std::string& name, const std::function<void()>& f, const std::vector<task_id>& inputs = std::vector<task_id>())
+	{
+		const task_id id = m_tasks.size();
+
+		for(const task_id input : inputs)
+		{
+			if(input >= id)
+				throw std::logic_error("Stage " + name + " depends on an unknown stage");
+
+			m_tasks[input].dependents.push_back(id);
+		}
+
+		m_tasks.push_back({name, f, std::vector<task_id>(), inputs.size()});
+		return id;
+	}
+
+	/* Runs all stages; rethrows the first exception after the running stages finish, remaining stages are skipped */
+	void run(size_t thread_count = std::thread::hardware_concurrency())
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<task_id> ready;
+		std::deque<std::function<void()>> jobs;
+		size_t remaining = m_tasks.size();
+		std::exception_ptr error;
+
+		// Stages may have little parallelism between them but plenty within, so all threads are started regardless
+		thread_count = std::max<size_t>(thread_count, 1);
+		pool_t pool(mutex, cv, jobs, thread_count);
+
+		for(task_id i = 0; i < m_tasks.size(); ++i)
+			if(m_tasks[i].pending == 0)
+				ready.push_back(i);
+
+		auto worker = [&]() {
+			trace::name_thread("stages");
+			worker_pool::current() = &pool;
+
+			std::unique_lock<std::mutex> lock(mutex);
+			while(true)
+			{
+				cv.wait(lock, [&]() { return !jobs.empty() || !ready.empty() || remaining == 0 || error; });
+
+				// Jobs left once all stages are done belong to finished parallel_fors and have nothing left to do
+				if(remaining == 0 || error)
+					return;
+
+				if(!jobs.empty())
+				{
+					std::function<void()> job = std::move(jobs.front());
+					jobs.pop_front();
+
+					lock.unlock();
+					job();
+					job = nullptr;
+					lock.lock();
+					continue;
+				}
+
+				const task_id id = ready.front();
+				ready.pop_front();
+
+				lock.unlock();
+				try
+				{
+					trace::zone zone(m_tasks[id].name);
+					m_tasks[id].f();
+				} catch(...)
+				{
+					lock.lock();
+					std::cerr << "Stage " << m_tasks[id].name << " failed" << std::endl;
+					if(!error)
+						error = std::current_exception();
+					cv.notify_all();
+					return;
+				}
+				lock.lock();
+
+				for(const task_id d : m_tasks[id].dependents)
+					if(--m_tasks[d].pending == 0)
+						ready.push_back(d);
+
+				--remaining;
+				cv.notify_all();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for(size_t i = 0; i < thread_count; ++i)
+			threads.emplace_back(worker);
+
+		for(std::thread& t : threads)
+			t.join();
+
+		if(error)
+			std::rethrow_exception(error);
+	}
+};
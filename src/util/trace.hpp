@@ -0,0 +1,216 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdint>
+
+/*
+ * Scoped-zone profiler that writes the Chrome trace-event format, for chrome://tracing or ui.perfetto.dev.
+ *
+ * Every thread records its finished zones in a ring buffer of its own, without locks; once a buffer is full the oldest
+ * zones are overwritten. Every thread gets a track of its own that outlives it; buffers grow with the zones recorded,
+ * so short-lived threads cost little. While tracing is off, a zone costs a relaxed atomic load.
+ * write() reads the buffers of all threads, so it must be called once the traced work is done.
+ */
+class trace
+{
+public:
+	static constexpr size_t capacity = 1 << 15; // Zones kept per thread
+	static constexpr size_t name_size = 48; // Longer names are truncated
+
+private:
+	trace() = delete;
+	trace(trace&) = delete;
+	trace& operator=(trace&) = delete;
+
+	struct event_t
+	{
+		char name[name_size];
+		int64_t begin, end; // Nanoseconds since start()
+	};
+
+	struct buffer_t
+	{
+		std::vector<event_t> events; // Grows up to capacity, then wraps
+		std::atomic<size_t> count; // Zones ever recorded; only written by the thread that owns the buffer
+		size_t tid;
+		std::string thread_name;
+
+		buffer_t(const size_t tid)
+		: events()
+		, count(0)
+		, tid(tid)
+		, thread_name()
+		{}
+	};
+
+	struct state_t
+	{
+		std::atomic<bool> enabled;
+		std::mutex mutex;
+		std::vector<std::shared_ptr<buffer_t>> buffers; // Shared, so that the zones of finished threads are kept
+		std::chrono::steady_clock::time_point epoch;
+
+		state_t()
+		: enabled(false)
+		, mutex()
+		, buffers()
+		, epoch(std::chrono::steady_clock::now())
+		{}
+	};
+
+	static state_t& state()
+	{
+		static state_t s;
+		return s;
+	}
+
+	static buffer_t& local_buffer()
+	{
+		thread_local buffer_t* buffer = nullptr;
+		if(!buffer)
+		{
+			state_t& s = state();
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.buffers.push_back(std::make_shared<buffer_t>(s.buffers.size() + 1));
+			buffer = s.buffers.back().get();
+		}
+
+		return *buffer;
+	}
+
+	static int64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - state().epoch).count();
+	}
+
+	static void record(const char* name, const int64_t begin, const int64_t end)
+	{
+		buffer_t& b = local_buffer();
+		const size_t i = b.count.load(std::memory_order_relaxed);
+
+		if(b.events.size() < capacity)
+			b.events.emplace_back();
+
+		event_t& e = b.events[i % capacity];
+		std::strncpy(e.name, name, name_size - 1);
+		e.name[name_size - 1] = '\0';
+		e.begin = begin;
+		e.end = end;
+
+		b.count.store(i + 1, std::memory_order_release);
+	}
+
+	static void write_string(std::ostream& os, const char* str)
+	{
+		os << '"';
+		for(; *str != '\0'; ++str)
+		{
+			if(*str == '"' || *str == '\\')
+				os << '\\';
+			os << *str;
+		}
+		os << '"';
+	}
+
+public:
+	/* Times the scope it lives in; name must stay valid until the zone ends */
+	class zone
+	{
+		const char* m_name;
+		int64_t m_begin;
+
+		zone(const zone&) = delete;
+		zone& operator=(const zone&) = delete;
+
+	public:
+		zone(const char* name)
+		: m_name(enabled() ? name : nullptr)
+		, m_begin(m_name ? now() : 0)
+		{}
+
+		zone(const std::string& name)
+		: zone(name.c_str())
+		{}
+
+		~zone()
+		{
+			if(m_name)
+				record(m_name, m_begin, now());
+		}
+	};
+
+	static bool enabled()
+	{
+		return state().enabled.load(std::memory_order_relaxed);
+	}
+
+	/* Starts recording; timestamps are relative to this call */
+	static void start()
+	{
+		state_t& s = state();
+		s.epoch = std::chrono::steady_clock::now();
+		s.enabled.store(true, std::memory_order_release);
+	}
+
+	/* Labels the calling thread in the trace */
+	static void name_thread(const std::string& name)
+	{
+		if(!enabled())
+			return;
+
+		buffer_t& b = local_buffer();
+		std::lock_guard<std::mutex> lock(state().mutex);
+		b.thread_name = name;
+	}
+
+	/* Writes the recorded zones of all threads as trace-event JSON; returns false if the file could not be written */
+	static bool write(const std::string& filename)
+	{
+		state_t& s = state();
+		std::lock_guard<std::mutex> lock(s.mutex);
+
+		std::ofstream os(filename);
+		os << std::fixed << std::setprecision(3);
+		os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+
+		bool first = true;
+		for(const std::shared_ptr<buffer_t>& b : s.buffers)
+		{
+			const size_t count = b->count.load(std::memory_order_acquire);
+			const size_t begin = count > capacity ? count - capacity : 0;
+
+			if(!b->thread_name.empty())
+			{
+				os << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b->tid << ", \"args\": {\"name\": ";
+				write_string(os, b->thread_name.c_str());
+				os << "}}";
+				first = false;
+			}
+
+			for(size_t i = begin; i < count; ++i)
+			{
+				const event_t& e = b->events[i % capacity];
+
+				// Complete events, in microseconds
+				os << (first ? "" : ",\n") << "{\"name\": ";
+				write_string(os, e.name);
+				os << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b->tid
+					<< ", \"ts\": " << e.begin / 1000.0
+					<< ", \"dur\": " << (e.end - e.begin) / 1000.0
+					<< "}";
+				first = false;
+			}
+		}
+
+		os << std::endl << "]}" << std::endl;
+		return (bool)os;
+	}
+};
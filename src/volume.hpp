@@ -4,7 +4,21 @@
 #include <msgpack.hpp>
 
 #include "gl/glm_include.hpp"
+#include "util/hugepage_allocator.hpp"
+#include "util/msgpack_blob.hpp"
 
+template<typename E>
+struct volume_expr;
+
+/* glm vectors default-construct to zero */
+template<> struct lazy_zero<glm::vec3> : std::true_type {};
+template<> struct lazy_zero<glm::vec4> : std::true_type {};
+template<> struct lazy_zero<glm::uvec4> : std::true_type {};
+
+/*
+ * Dense volume, indexed with z fastest. Storage comes from hugepage_allocator: construction does not touch memory,
+ * pages are faulted in zeroed by the thread that first writes them, so fill volumes with parallel_for over x slabs.
+ */
 template<typename T, size_t X, size_t Y, size_t Z>
 class volume
 {
@@ -12,7 +26,7 @@ public:
 	static constexpr size_t size = X*Y*Z;
 
 private:
-	std::vector<T> m_data;
+	std::vector<T, hugepage_allocator<T>> m_data;
 
 public:
 	volume()
@@ -21,6 +35,16 @@ public:
 		m_data.resize(size);
 	}
 
+	T* data()
+	{
+		return m_data.data();
+	}
+
+	const T* data() const
+	{
+		return m_data.data();
+	}
+
 	T& operator[](const glm::uvec3& pos)
 	{
 		return m_data[pos.x * Y * Z + pos.y * Z + pos.z];
@@ -31,6 +55,10 @@ public:
 		return m_data[pos.x * Y * Z + pos.y * Z + pos.z];
 	}
 
+	/* Fused evaluation of an expression template, see volumeexpr.hpp */
+	template<typename E>
+	volume& operator=(const volume_expr<E>& e);
+
 	void operator+=(const T x)
 	{
 		for(size_t i = 0; i < size; ++i)
@@ -49,5 +77,104 @@ public:
 			m_data[i] /= x;
 	}
 
-    MSGPACK_DEFINE(m_data)
+	/*
+	 * Packed as MSGPACK_DEFINE(m_data) would, which does not support custom allocators; voxel types registered with
+	 * MSGPACK_BLOB_TYPE are stored as a single blob, others element by element.
+	 */
+	template<typename Packer>
+	void msgpack_pack(Packer& pk) const
+	{
+		pk.pack_array(1);
+		pack_data(pk, std::integral_constant<bool, blob_traits<T>::enabled>());
+	}
+
+	void msgpack_unpack(msgpack::object o)
+	{
+		if(o.type != msgpack::type::ARRAY || o.via.array.size != 1)
+			throw msgpack::type_error();
+
+		const msgpack::object& data = o.via.array.ptr[0];
+		if(msgpack_blob::is_blob<T>(data))
+		{
+			unpack_blob(data, std::integral_constant<bool, blob_traits<T>::enabled>());
+			return;
+		}
+
+		if(data.type != msgpack::type::ARRAY || data.via.array.size != size)
+			throw msgpack::type_error();
+
+		for(size_t i = 0; i < size; ++i)
+			data.via.array.ptr[i].convert(&m_data[i]);
+	}
+
+	/* Streaming counterpart of msgpack_unpack, see util/msgpackstream.hpp; blobs are read straight into the volume */
+	template<typename Stream>
+	void msgpack_stream_unpack(Stream& s)
+	{
+		if(s.read_array_header() != 1)
+			throw msgpack::type_error();
+
+		if(stream_blob(s, std::integral_constant<bool, blob_traits<T>::enabled>()))
+			return;
+
+		if(s.read_array_header() != size)
+			throw msgpack::type_error();
+
+		for(T& x : m_data)
+			s.convert(x);
+	}
+
+private:
+	template<typename Stream>
+	bool stream_blob(Stream& s, std::true_type)
+	{
+		if(!s.next_is_blob())
+			return false;
+
+		size_t offset = 0;
+		for(size_t parts = s.template read_blob_header<T>(); parts > 0; --parts)
+		{
+			const size_t n = s.template read_blob_part<T>();
+			if(n > size - offset)
+				throw msgpack::type_error();
+
+			s.read_blob_body(m_data.data() + offset, n);
+			offset += n;
+		}
+
+		if(offset != size)
+			throw msgpack::type_error();
+
+		return true;
+	}
+
+	template<typename Stream>
+	bool stream_blob(Stream&, std::false_type)
+	{
+		return false;
+	}
+
+	template<typename Packer>
+	void pack_data(Packer& pk, std::true_type) const
+	{
+		msgpack_blob::pack(pk, m_data.data(), size);
+	}
+
+	template<typename Packer>
+	void pack_data(Packer& pk, std::false_type) const
+	{
+		pk.pack_array(size);
+		for(const T& x : m_data)
+			pk.pack(x);
+	}
+
+	void unpack_blob(const msgpack::object& data, std::true_type)
+	{
+		msgpack_blob::unpack(data, m_data.data(), size);
+	}
+
+	void unpack_blob(const msgpack::object&, std::false_type)
+	{
+		throw msgpack::type_error();
+	}
 };
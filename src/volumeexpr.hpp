@@ -0,0 +1,407 @@
+#pragma once
+
+#include <utility>
+
+#include "volume.hpp"
+#include "voxel.hpp"
+#include "sparsevolume.hpp"
+
+#include "util/parallel.hpp"
+
+/*
+ * Lazy expression templates over volumes. An expression is only evaluated when it is assigned to a volume
+ * (or one of its channels), in a single fused loop over the destination:
+ *
+ *   dust = rgba(rgb(light) * k * rgb(dust), clamp(alpha(dust), 0.0f, 1.0f));
+ *   rgb(dust) = rgb(light) * k * rgb(dust);
+ *
+ * Voxels are decoded to GLfloat, glm::vec3 or glm::vec4 when read and encoded to the storage type when written.
+ * Every voxel is computed from the same position in all operands, so a destination may also appear in its expression.
+ * All operands are expected to have the dimensions of the destination.
+ */
+
+template<typename E>
+struct volume_expr
+{
+	const E& self() const
+	{
+		return static_cast<const E&>(*this);
+	}
+};
+
+template<typename T, size_t X, size_t Y, size_t Z>
+class voxel_terminal : public volume_expr<voxel_terminal<T, X, Y, Z>>
+{
+	const T* m_data;
+
+public:
+	voxel_terminal(const volume<T, X, Y, Z>& v)
+	: m_data(v.data())
+	{}
+
+	auto eval(const glm::uvec3&, const size_t i) const -> decltype(voxel_value(std::declval<T>()))
+	{
+		return voxel_value(m_data[i]);
+	}
+};
+
+/* Voxels of a buffer laid out as a volume with Y*Z planes but holding only its x-planes from x_origin on */
+template<typename T, size_t Y, size_t Z>
+class plane_terminal : public volume_expr<plane_terminal<T, Y, Z>>
+{
+	const T* m_data;
+	size_t m_offset;
+
+public:
+	plane_terminal(const T* planes, const size_t x_origin)
+	: m_data(planes)
+	, m_offset(x_origin * Y * Z)
+	{}
+
+	auto eval(const glm::uvec3&, const size_t i) const -> decltype(voxel_value(std::declval<T>()))
+	{
+		return voxel_value(m_data[i - m_offset]);
+	}
+};
+
+template<typename T, size_t X, size_t Y, size_t Z, size_t B>
+class sparse_terminal : public volume_expr<sparse_terminal<T, X, Y, Z, B>>
+{
+	const sparse_volume<T, X, Y, Z, B>& m_volume;
+
+public:
+	sparse_terminal(const sparse_volume<T, X, Y, Z, B>& v)
+	: m_volume(v)
+	{}
+
+	auto eval(const glm::uvec3& pos, const size_t) const -> decltype(voxel_value(std::declval<T>()))
+	{
+		return voxel_value(m_volume[pos]);
+	}
+};
+
+template<typename V>
+class constant_expr : public volume_expr<constant_expr<V>>
+{
+	V m_value;
+
+public:
+	constant_expr(const V& value)
+	: m_value(value)
+	{}
+
+	const V& eval(const glm::uvec3&, const size_t) const
+	{
+		return m_value;
+	}
+};
+
+template<typename A, typename F>
+class unary_expr : public volume_expr<unary_expr<A, F>>
+{
+	A m_a;
+
+public:
+	unary_expr(const A& a)
+	: m_a(a)
+	{}
+
+	auto eval(const glm::uvec3& pos, const size_t i) const -> decltype(F::apply(std::declval<const A&>().eval(pos, i)))
+	{
+		return F::apply(m_a.eval(pos, i));
+	}
+};
+
+template<typename A, typename B, typename F>
+class binary_expr : public volume_expr<binary_expr<A, B, F>>
+{
+	A m_a;
+	B m_b;
+
+public:
+	binary_expr(const A& a, const B& b)
+	: m_a(a)
+	, m_b(b)
+	{}
+
+	auto eval(const glm::uvec3& pos, const size_t i) const -> decltype(F::apply(std::declval<const A&>().eval(pos, i), std::declval<const B&>().eval(pos, i)))
+	{
+		return F::apply(m_a.eval(pos, i), m_b.eval(pos, i));
+	}
+};
+
+template<typename A, typename B, typename C, typename F>
+class ternary_expr : public volume_expr<ternary_expr<A, B, C, F>>
+{
+	A m_a;
+	B m_b;
+	C m_c;
+
+public:
+	ternary_expr(const A& a, const B& b, const C& c)
+	: m_a(a)
+	, m_b(b)
+	, m_c(c)
+	{}
+
+	auto eval(const glm::uvec3& pos, const size_t i) const -> decltype(F::apply(std::declval<const A&>().eval(pos, i), std::declval<const B&>().eval(pos, i), std::declval<const C&>().eval(pos, i)))
+	{
+		return F::apply(m_a.eval(pos, i), m_b.eval(pos, i), m_c.eval(pos, i));
+	}
+};
+
+namespace volume_ops
+{
+	struct add { template<typename A, typename B> static auto apply(const A& a, const B& b) -> decltype(a + b) { return a + b; } };
+	struct sub { template<typename A, typename B> static auto apply(const A& a, const B& b) -> decltype(a - b) { return a - b; } };
+	struct mul { template<typename A, typename B> static auto apply(const A& a, const B& b) -> decltype(a * b) { return a * b; } };
+	struct div { template<typename A, typename B> static auto apply(const A& a, const B& b) -> decltype(a / b) { return a / b; } };
+
+	/* Quotient that is 0 where the divisor is not positive, rather than NaN or infinite */
+	struct ratio { static GLfloat apply(const GLfloat a, const GLfloat b) { return b > 0.0f ? a / b : 0.0f; } };
+
+	struct rgb
+	{
+		static glm::vec3 apply(const glm::vec4& v) { return glm::vec3(v.r, v.g, v.b); }
+		static glm::vec3 apply(const glm::vec3& v) { return v; }
+	};
+
+	struct alpha
+	{
+		static GLfloat apply(const glm::vec4& v) { return v.a; }
+		static GLfloat apply(const GLfloat v) { return v; }
+	};
+
+	struct rgba { static glm::vec4 apply(const glm::vec3& c, const GLfloat a) { return glm::vec4(c, a); } };
+	struct mix { template<typename A, typename T> static A apply(const A& a, const A& b, const T& t) { return glm::mix(a, b, t); } };
+	struct clamp { template<typename A> static A apply(const A& a, const A& lo, const A& hi) { return glm::clamp(a, lo, hi); } };
+
+	/* Writes a value to a whole voxel, or to a channel while keeping the others */
+	struct store_voxel
+	{
+		template<typename T, typename V>
+		static void apply(T& dst, const V& v) { dst = voxel_store<T>::apply(v); }
+	};
+
+	struct store_rgb
+	{
+		template<typename T>
+		static void apply(T& dst, const glm::vec3& v) { dst = voxel_codec<T>::encode(glm::vec4(v, voxel_codec<T>::alpha(dst))); }
+	};
+
+	struct store_alpha
+	{
+		template<typename T>
+		static void apply(T& dst, const GLfloat a)
+		{
+			glm::vec4 v = voxel_codec<T>::decode(dst);
+			v.a = a;
+			dst = voxel_codec<T>::encode(v);
+		}
+
+		static void apply(GLfloat& dst, const GLfloat a) { dst = a; }
+	};
+}
+
+/*
+ * Evaluates an expression of a X*Y*Z volume for the voxels in [begin, end), into planes: a buffer laid out as the volume
+ * but holding only its x-planes from x_origin on, such as one slab of it
+ */
+template<typename S, size_t Y, size_t Z, typename T, typename E>
+void evaluate_region(T* planes, const size_t x_origin, const volume_expr<E>& e, const glm::uvec3& begin, const glm::uvec3& end)
+{
+	const E& expr = e.self();
+
+	for(size_t x = begin.x; x < end.x; ++x)
+		for(size_t y = begin.y; y < end.y; ++y)
+		{
+			const size_t row = x * Y * Z + y * Z;
+			T* const dst = planes + (x - x_origin) * Y * Z + y * Z;
+			for(size_t z = begin.z; z < end.z; ++z)
+				S::apply(dst[z], expr.eval(glm::uvec3(x, y, z), row + z));
+		}
+}
+
+/* Evaluates an expression for the voxels in [begin, end) of the destination */
+template<typename S, typename T, size_t X, size_t Y, size_t Z, typename E>
+void evaluate_region(volume<T, X, Y, Z>& dst, const volume_expr<E>& e, const glm::uvec3& begin, const glm::uvec3& end)
+{
+	evaluate_region<S, Y, Z>(dst.data(), 0, e, begin, end);
+}
+
+template<typename T, size_t X, size_t Y, size_t Z, typename E>
+void evaluate_region(volume<T, X, Y, Z>& dst, const volume_expr<E>& e, const glm::uvec3& begin, const glm::uvec3& end)
+{
+	evaluate_region<volume_ops::store_voxel>(dst, e, begin, end);
+}
+
+/* Evaluates an expression for the whole destination, split in x-slabs over all cores unless parallel is false */
+template<typename S, typename T, size_t X, size_t Y, size_t Z, typename E>
+void evaluate(volume<T, X, Y, Z>& dst, const volume_expr<E>& e, const bool parallel = true)
+{
+	if(!parallel)
+	{
+		evaluate_region<S>(dst, e, glm::uvec3(0, 0, 0), glm::uvec3(X, Y, Z));
+		return;
+	}
+
+	parallel_for(0, X, [&](const size_t x) {
+		evaluate_region<S>(dst, e, glm::uvec3(x, 0, 0), glm::uvec3(x + 1, Y, Z));
+	});
+}
+
+template<typename T, size_t X, size_t Y, size_t Z, typename E>
+void evaluate(volume<T, X, Y, Z>& dst, const volume_expr<E>& e, const bool parallel = true)
+{
+	evaluate<volume_ops::store_voxel>(dst, e, parallel);
+}
+
+template<typename T, size_t X, size_t Y, size_t Z>
+template<typename E>
+volume<T, X, Y, Z>& volume<T, X, Y, Z>::operator=(const volume_expr<E>& e)
+{
+	evaluate(*this, e);
+	return *this;
+}
+
+/* Assignable channel of a volume, which can also be read as an expression */
+template<typename S, typename F, typename T, size_t X, size_t Y, size_t Z>
+class channel_target : public volume_expr<channel_target<S, F, T, X, Y, Z>>
+{
+	volume<T, X, Y, Z>& m_volume;
+
+public:
+	channel_target(volume<T, X, Y, Z>& v)
+	: m_volume(v)
+	{}
+
+	channel_target(const channel_target&) = default;
+
+	auto eval(const glm::uvec3&, const size_t i) const -> decltype(F::apply(voxel_value(std::declval<T>())))
+	{
+		return F::apply(voxel_value(m_volume.data()[i]));
+	}
+
+	template<typename E>
+	channel_target& operator=(const volume_expr<E>& e)
+	{
+		evaluate<S>(m_volume, e);
+		return *this;
+	}
+
+	channel_target& operator=(const channel_target& e)
+	{
+		evaluate<S>(m_volume, e);
+		return *this;
+	}
+};
+
+template<typename T, size_t X, size_t Y, size_t Z>
+voxel_terminal<T, X, Y, Z> voxels(const volume<T, X, Y, Z>& v)
+{
+	return voxel_terminal<T, X, Y, Z>(v);
+}
+
+template<typename T, size_t X, size_t Y, size_t Z, size_t B>
+sparse_terminal<T, X, Y, Z, B> voxels(const sparse_volume<T, X, Y, Z, B>& v)
+{
+	return sparse_terminal<T, X, Y, Z, B>(v);
+}
+
+template<size_t Y, size_t Z, typename T>
+plane_terminal<T, Y, Z> planes(const T* data, const size_t x_origin)
+{
+	return plane_terminal<T, Y, Z>(data, x_origin);
+}
+
+template<typename V>
+constant_expr<V> constant(const V& v)
+{
+	return constant_expr<V>(v);
+}
+
+template<typename A>
+unary_expr<A, volume_ops::rgb> rgb(const volume_expr<A>& a)
+{
+	return unary_expr<A, volume_ops::rgb>(a.self());
+}
+
+template<typename T, size_t X, size_t Y, size_t Z>
+unary_expr<voxel_terminal<T, X, Y, Z>, volume_ops::rgb> rgb(const volume<T, X, Y, Z>& v)
+{
+	return rgb(voxels(v));
+}
+
+template<typename T, size_t X, size_t Y, size_t Z>
+channel_target<volume_ops::store_rgb, volume_ops::rgb, T, X, Y, Z> rgb(volume<T, X, Y, Z>& v)
+{
+	return channel_target<volume_ops::store_rgb, volume_ops::rgb, T, X, Y, Z>(v);
+}
+
+template<typename A>
+unary_expr<A, volume_ops::alpha> alpha(const volume_expr<A>& a)
+{
+	return unary_expr<A, volume_ops::alpha>(a.self());
+}
+
+template<typename T, size_t X, size_t Y, size_t Z>
+unary_expr<voxel_terminal<T, X, Y, Z>, volume_ops::alpha> alpha(const volume<T, X, Y, Z>& v)
+{
+	return alpha(voxels(v));
+}
+
+template<typename T, size_t X, size_t Y, size_t Z>
+channel_target<volume_ops::store_alpha, volume_ops::alpha, T, X, Y, Z> alpha(volume<T, X, Y, Z>& v)
+{
+	return channel_target<volume_ops::store_alpha, volume_ops::alpha, T, X, Y, Z>(v);
+}
+
+template<typename A, typename B>
+binary_expr<A, B, volume_ops::rgba> rgba(const volume_expr<A>& color, const volume_expr<B>& a)
+{
+	return binary_expr<A, B, volume_ops::rgba>(color.self(), a.self());
+}
+
+template<typename A, typename B>
+binary_expr<A, B, volume_ops::ratio> ratio(const volume_expr<A>& a, const volume_expr<B>& b)
+{
+	return binary_expr<A, B, volume_ops::ratio>(a.self(), b.self());
+}
+
+template<typename A, typename B, typename C>
+ternary_expr<A, B, C, volume_ops::mix> mix(const volume_expr<A>& a, const volume_expr<B>& b, const volume_expr<C>& t)
+{
+	return ternary_expr<A, B, C, volume_ops::mix>(a.self(), b.self(), t.self());
+}
+
+template<typename A, typename V>
+ternary_expr<A, constant_expr<V>, constant_expr<V>, volume_ops::clamp> clamp(const volume_expr<A>& a, const V& lo, const V& hi)
+{
+	return ternary_expr<A, constant_expr<V>, constant_expr<V>, volume_ops::clamp>(a.self(), lo, hi);
+}
+
+#define VOLUME_EXPR_OPERATOR(op, functor) \
+	template<typename A, typename B> \
+	binary_expr<A, B, volume_ops::functor> operator op(const volume_expr<A>& a, const volume_expr<B>& b) \
+	{ \
+		return binary_expr<A, B, volume_ops::functor>(a.self(), b.self()); \
+	} \
+	\
+	template<typename A> \
+	binary_expr<A, constant_expr<GLfloat>, volume_ops::functor> operator op(const volume_expr<A>& a, const GLfloat b) \
+	{ \
+		return binary_expr<A, constant_expr<GLfloat>, volume_ops::functor>(a.self(), b); \
+	} \
+	\
+	template<typename B> \
+	binary_expr<constant_expr<GLfloat>, B, volume_ops::functor> operator op(const GLfloat a, const volume_expr<B>& b) \
+	{ \
+		return binary_expr<constant_expr<GLfloat>, B, volume_ops::functor>(a, b.self()); \
+	}
+
+VOLUME_EXPR_OPERATOR(+, add)
+VOLUME_EXPR_OPERATOR(-, sub)
+VOLUME_EXPR_OPERATOR(*, mul)
+VOLUME_EXPR_OPERATOR(/, div)
+
+#undef VOLUME_EXPR_OPERATOR
@@ -1,25 +1,37 @@
 #pragma once
 
 #include <vector>
+#include <utility>
+#include <algorithm>
 
 #include "nebula.hpp"
+#include "volumepyramid.hpp"
+#include "volumesampler.hpp"
+#include "volumeexpr.hpp"
 
 #include "gl/glm_opts.hpp"
+#include "util/parallel.hpp"
+#include "util/trace.hpp"
 
-template<size_t X, size_t Y, size_t Z>
+template<size_t X, size_t Y, size_t Z, typename D = glm::vec4, typename L = glm::vec3>
 class volumelighting
 {
 	static constexpr GLfloat fX = X, fY = Y, fZ = Z;
 
-	static GLfloat raycast_stars(const std::vector<star_t>& nebula_stars, volume<glm::vec3, X, Y, Z>& light_volume, const volume<glm::vec4, X, Y, Z>& dust_volume)
+	/* Lights the voxels with x in [x_begin, x_end); returns the highest total intensity among them */
+	static GLfloat raycast_stars(const std::vector<star_t>& nebula_stars, volume<L, X, Y, Z>& light_volume, const volume<D, X, Y, Z>& dust_volume, const density_pyramid<X, Y, Z, D>& pyramid, const size_t x_begin, const size_t x_end)
 	{
 		static constexpr GLfloat occlusion = 0.005;
-		static constexpr GLfloat stepsize = 0.001;
+		static constexpr GLfloat stepsize = 0.002; // Trilinear samples are smooth enough for twice the stride of nearest samples
 		static constexpr GLfloat falloff = 1.2;
+		static constexpr size_t batch = 32;
+
+		const volume_sampler<D, X, Y, Z> sampler(dust_volume);
+		GLfloat xs[batch], ys[batch], zs[batch], alphas[batch];
 
 		GLfloat max_intensity = 0.0;
 
-		for(size_t x = 0; x < X; ++x)
+		for(size_t x = x_begin; x < x_end; ++x)
 			for(size_t y = 0; y < Y; ++y)
 				for(size_t z = 0; z < Z; ++z)
 				{
@@ -46,15 +58,42 @@ class volumelighting
 						size_t step_count = len / delta_dir_len - 1;
 
 						GLfloat intensity = 1.0;
-						for(size_t i = 0; i < step_count; ++i)
+						bool probe = true; // The last sample was empty, so look for empty space before the next
+						for(size_t i = 0; i < step_count && intensity > 0.0;)
 						{
-							glm::uvec3 uvec = upcast(vec, fX, fY, fZ);
-							intensity -= dust_volume[uvec].a * occlusion * stepsize;
-
-							vec += delta_dir;
-
-							if(intensity <= 0.0)
-								break;
+							// Collect a batch of sample positions; empty cells do not occlude, so after an empty sample the pyramid is asked
+							// how many steps ahead stay empty, and those are skipped
+							size_t n = 0;
+							while(n < batch && i < step_count)
+							{
+								if(probe)
+								{
+									const size_t skip_steps = pyramid.empty_distance(vec, norm_dir, 0.0f, 0.5f) / stepsize;
+									i += skip_steps;
+									vec += delta_dir * (GLfloat)skip_steps;
+									probe = false;
+									continue;
+								}
+
+								xs[n] = vec.x;
+								ys[n] = vec.y;
+								zs[n] = vec.z;
+								++n;
+
+								vec += delta_dir;
+								++i;
+							}
+
+							sampler.alpha_trilinear(xs, ys, zs, alphas, n);
+							probe = n > 0 && alphas[n - 1] <= 0.0f;
+
+							for(size_t j = 0; j < n; ++j)
+							{
+								intensity -= alphas[j] * occlusion * stepsize;
+
+								if(intensity <= 0.0)
+									break;
+							}
 						}
 
 						intensity *= 1.0f - std::pow(len*falloff, 2.0f);
@@ -66,7 +105,7 @@ class volumelighting
 						}
 					}
 
-					light_volume[pos] = color;
+					light_volume[pos] = voxel_codec<L>::encode(glm::vec4(color, 0.0f));
 					max_intensity = glm::max(max_intensity, total_intensity);
 				}
 
@@ -84,29 +123,84 @@ class volumelighting
 				}
 	}
 
-	static void apply_lighting_to_dust(volume<glm::vec4, X, Y, Z>& nebula_dust, const volume<glm::vec3, X, Y, Z>& light_volume, const volume<glm::vec4, X, Y, Z>& dust_volume, const GLfloat intensity_multiplier)
+public:
+	/*
+	 * Lights the x-planes [x_begin, x_end) of the dust, so that slabs can be lit one at a time; both buffers hold only
+	 * those planes. Given the pyramid of the whole dust, cells that are empty_around are skipped and keep their colour.
+	 */
+	static void apply_lighting_to_dust(D* dust, const L* light, const size_t x_begin, const size_t x_end, const GLfloat intensity_multiplier, const density_pyramid<X, Y, Z, D>* pyramid = nullptr)
 	{
-		for(size_t x = 0; x < X; ++x)
-			for(size_t y = 0; y < Y; ++y)
-				for(size_t z = 0; z < Z; ++z)
+		trace::zone zone("apply lighting");
+
+		const auto lit = rgba(
+			(rgb(planes<Y, Z>(light, x_begin)) * intensity_multiplier) * rgb(planes<Y, Z>(dust, x_begin)),
+			clamp(alpha(planes<Y, Z>(dust, x_begin)), 0.0f, 1.0f)
+		);
+
+		if(!pyramid)
+		{
+			parallel_for(x_begin, x_end, [&](const size_t x) {
+				evaluate_region<volume_ops::store_voxel, Y, Z>(dust, x_begin, lit, glm::uvec3(x, 0, 0), glm::uvec3(x + 1, Y, Z));
+			});
+			return;
+		}
+
+		const size_t block = pyramid->level(0).block;
+		const glm::uvec3 dim = pyramid->level(0).dim;
+
+		parallel_for(x_begin / block, (x_end + block - 1) / block, [&](const size_t cx) {
+			for(size_t cy = 0; cy < dim.y; ++cy)
+				for(size_t cz = 0; cz < dim.z; ++cz)
 				{
-					glm::uvec3 pos(x, y, z);
+					const glm::uvec3 cell(cx, cy, cz);
+					if(pyramid->empty_around(0, cell))
+						continue;
 
-					glm::vec3 color_tmp = (light_volume[pos] * intensity_multiplier) * dust_volume[pos].rgb();
-					set_rgb(nebula_dust[pos], color_tmp);
-					nebula_dust[pos].a = glm::clamp(dust_volume[pos].a, 0.0f, 1.0f);
+					const glm::uvec3 begin(std::max(cx * block, x_begin), cy * block, cz * block);
+					const glm::uvec3 end(std::min((cx + 1) * block, x_end), std::min((cy + 1) * block, Y), std::min((cz + 1) * block, Z));
+					evaluate_region<volume_ops::store_voxel, Y, Z>(dust, x_begin, lit, begin, end);
 				}
+		});
 	}
 
-public:
-	static void apply_lighting(volume_nebula_t<X, Y, Z>& n)
+	/*
+	 * X-range of dust that shadow rays into the slab [x_begin, x_end) pass through: rays run straight from each star,
+	 * so this spans the slab and all stars, plus a voxel for the trilinear footprint.
+	 */
+	static std::pair<size_t, size_t> shadow_halo(const std::vector<star_t>& stars, const size_t x_begin, const size_t x_end)
+	{
+		GLfloat lo = x_begin, hi = x_end;
+		for(const star_t& star : stars)
+		{
+			lo = std::min(lo, std::floor(star.pos.x * (X - 1)));
+			hi = std::max(hi, std::ceil(star.pos.x * (X - 1)) + 1.0f);
+		}
+
+		return std::make_pair((size_t)glm::clamp(lo - 1.0f, 0.0f, fX), (size_t)glm::clamp(hi + 1.0f, 0.0f, fX));
+	}
+
+	/* Raycasts the slab [x_begin, x_end) into light; the dust must be complete within shadow_halo of the slab */
+	static GLfloat light_slab(const volume_nebula_t<X, Y, Z, D>& n, const density_pyramid<X, Y, Z, D>& pyramid, volume<L, X, Y, Z>& light_volume, const size_t x_begin, const size_t x_end)
+	{
+		trace::zone zone("raycast stars");
+		return raycast_stars(n.stars, light_volume, n.dust, pyramid, x_begin, x_end);
+	}
+
+	static GLfloat light_slab(const volume_nebula_t<X, Y, Z, D>& n, volume<L, X, Y, Z>& light_volume, const size_t x_begin, const size_t x_end)
+	{
+		const density_pyramid<X, Y, Z, D> pyramid(n.dust);
+		return light_slab(n, pyramid, light_volume, x_begin, x_end);
+	}
+
+	static void apply_lighting(volume_nebula_t<X, Y, Z, D>& n)
 	{
 		std::cerr << "Raycasting stars" << std::endl;
 
-		volume<glm::vec3, X, Y, Z> light_volume;
-		GLfloat max_intensity = raycast_stars(n.stars, light_volume, n.dust);
+		const density_pyramid<X, Y, Z, D> pyramid(n.dust);
+		volume<L, X, Y, Z> light_volume;
+		GLfloat max_intensity = light_slab(n, pyramid, light_volume, 0, X);
 
 		std::cerr << "Applying lighting" << std::endl;
-		apply_lighting_to_dust(n.dust, light_volume, n.dust, max_intensity / ((GLfloat) n.stars.size()));
+		apply_lighting_to_dust(n.dust.data(), light_volume.data(), 0, X, max_intensity / ((GLfloat) n.stars.size()), &pyramid);
 	}
 };
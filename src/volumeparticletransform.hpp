@@ -1,12 +1,19 @@
 #pragma once
 
+#include <functional>
+
 #include "volume.hpp"
+#include "voxel.hpp"
+#include "volumepyramid.hpp"
 #include "particle.hpp"
+#include "util/trace.hpp"
 
-template<size_t X, size_t Y, size_t Z>
-std::vector<particle_t> volume_to_particles(const volume<glm::vec4, X, Y, Z>& dust, int seed, size_t budget = 500000)
+template<typename D, size_t X, size_t Y, size_t Z>
+std::vector<particle_t> volume_to_particles(const volume<D, X, Y, Z>& dust, int seed, size_t budget = 500000)
 {
 	std::cerr << "Instancing particles" << std::endl;
+	trace::zone zone("instance particles");
+
 	const static int mean = 100;
 
 	std::default_random_engine engine(seed+1);
@@ -16,37 +23,53 @@ std::vector<particle_t> volume_to_particles(const volume<glm::vec4, X, Y, Z>& du
 	const static GLfloat fmean = mean;
 	const static GLfloat fspread = 4.0f;
 
+	// Voxels without density get no particles and draw no random numbers, so visiting only occupied cells, in the same
+	// order, gives the same particles
+	const density_pyramid<X, Y, Z, D> pyramid(dust);
+	const typename density_pyramid<X, Y, Z, D>::level_t& cells = pyramid.level(0);
+
+	const auto for_each_occupied = [&cells](const std::function<void(const glm::uvec3&)>& f) {
+		for(size_t x = 0; x < X; ++x)
+			for(size_t y = 0; y < Y; ++y)
+				for(size_t z = 0; z < Z; ++z)
+				{
+					if(cells[glm::uvec3(x, y, z) / glm::uvec3(cells.block)].max <= 0.0f)
+					{
+						z += cells.block - 1 - z % cells.block; // To the last voxel of the cell
+						continue;
+					}
+
+					f(glm::uvec3(x, y, z));
+				}
+	};
+
 	std::vector<particle_t> particles;
 	GLfloat alpha_sum = 0.0f;
-	for(size_t x = 0; x < X; ++x)
-		for(size_t y = 0; y < Y; ++y)
-			for(size_t z = 0; z < Z; ++z)
-				alpha_sum += dust[glm::uvec3(x, y, z)].a;
+	for_each_occupied([&](const glm::uvec3& pos) {
+		alpha_sum += voxel_codec<D>::alpha(dust[pos]);
+	});
 
 	GLfloat max_particle_per_voxel = budget / alpha_sum;
 	std::cout << "Instancing " << max_particle_per_voxel << " particles per voxel (" << X << "x" << Y << "x" << Z << ")" << std::endl;
 
-	for(size_t x = 0; x < X; ++x)
-		for(size_t y = 0; y < Y; ++y)
-			for(size_t z = 0; z < Z; ++z)
-			{
-				const glm::vec4 v = dust[glm::uvec3(x, y, z)];
-				size_t particle_count = v.a * max_particle_per_voxel + 0.5f;
+	for_each_occupied([&](const glm::uvec3& pos) {
+		const glm::vec4 v = voxel_codec<D>::decode(dust[pos]);
+		size_t particle_count = v.a * max_particle_per_voxel + 0.5f;
 
-				assert(v.a >= 0.0f && v.a <= 1.0f);
+		assert(v.a >= 0.0f && v.a <= 1.0f);
 
-				for(size_t i = 0; i < particle_count; i++)
-				{
-					GLfloat xdist = dist(engine) * (fspread / fmean) - (fspread - 0.5f);
-					GLfloat ydist = dist(engine) * (fspread / fmean) - (fspread - 0.5f);
-					GLfloat zdist = dist(engine) * (fspread / fmean) - (fspread - 0.5f);
-
-					particles.emplace_back(particle_t({
-						glm::vec3((x + xdist)/fX, (y + ydist)/fY, (z + zdist)/fZ),
-						v
-					}));
-				}
-			}
+		for(size_t i = 0; i < particle_count; i++)
+		{
+			GLfloat xdist = dist(engine) * (fspread / fmean) - (fspread - 0.5f);
+			GLfloat ydist = dist(engine) * (fspread / fmean) - (fspread - 0.5f);
+			GLfloat zdist = dist(engine) * (fspread / fmean) - (fspread - 0.5f);
+
+			particles.emplace_back(particle_t({
+				glm::vec3((pos.x + xdist)/fX, (pos.y + ydist)/fY, (pos.z + zdist)/fZ),
+				v
+			}));
+		}
+	});
 
 	return particles;
 }
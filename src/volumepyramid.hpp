@@ -0,0 +1,217 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+
+#include "volume.hpp"
+#include "voxel.hpp"
+
+#include "gl/gl.hpp"
+#include "util/parallel.hpp"
+
+/*
+ * Min/max pyramid over the alpha (density) channel of a dust volume.
+ * Level 0 summarizes blocks of base_block^3 voxels, every next level halves the resolution.
+ *
+ * Positions are in the same normalized [0, 1] space as upcast/downcast, where voxel i lies at i / (N-1).
+ */
+template<size_t X, size_t Y, size_t Z, typename D = glm::vec4>
+class density_pyramid
+{
+public:
+	static constexpr size_t base_block = 4;
+
+	struct range_t
+	{
+		GLfloat min, max;
+	};
+
+	struct level_t
+	{
+		size_t block; // Voxels per cell edge
+		glm::uvec3 dim;
+		std::vector<range_t> cells;
+
+		range_t& operator[](const glm::uvec3& c)
+		{
+			return cells[c.x * dim.y * dim.z + c.y * dim.z + c.z];
+		}
+
+		const range_t& operator[](const glm::uvec3& c) const
+		{
+			return cells[c.x * dim.y * dim.z + c.y * dim.z + c.z];
+		}
+	};
+
+private:
+	std::vector<level_t> m_levels;
+
+	static level_t create_level(const size_t block)
+	{
+		level_t l;
+		l.block = block;
+		l.dim = glm::uvec3((X + block - 1) / block, (Y + block - 1) / block, (Z + block - 1) / block);
+		l.cells.resize(l.dim.x * l.dim.y * l.dim.z);
+		return l;
+	}
+
+	void build_base(const volume<D, X, Y, Z>& dust)
+	{
+		level_t& base = m_levels.front();
+
+		parallel_for(0, base.dim.x, [&](const size_t cx) {
+			for(size_t cy = 0; cy < base.dim.y; ++cy)
+				for(size_t cz = 0; cz < base.dim.z; ++cz)
+				{
+					range_t r = {std::numeric_limits<GLfloat>::max(), std::numeric_limits<GLfloat>::lowest()};
+
+					for(size_t x = cx * base_block; x < std::min((cx+1) * base_block, X); ++x)
+						for(size_t y = cy * base_block; y < std::min((cy+1) * base_block, Y); ++y)
+							for(size_t z = cz * base_block; z < std::min((cz+1) * base_block, Z); ++z)
+							{
+								const GLfloat a = voxel_codec<D>::alpha(dust[glm::uvec3(x, y, z)]);
+								r.min = std::min(r.min, a);
+								r.max = std::max(r.max, a);
+							}
+
+					base[glm::uvec3(cx, cy, cz)] = r;
+				}
+		});
+	}
+
+	static void build_level(const level_t& fine, level_t& coarse)
+	{
+		for(size_t cx = 0; cx < coarse.dim.x; ++cx)
+			for(size_t cy = 0; cy < coarse.dim.y; ++cy)
+				for(size_t cz = 0; cz < coarse.dim.z; ++cz)
+				{
+					range_t r = {std::numeric_limits<GLfloat>::max(), std::numeric_limits<GLfloat>::lowest()};
+
+					for(size_t x = cx*2; x < std::min<size_t>(cx*2 + 2, fine.dim.x); ++x)
+						for(size_t y = cy*2; y < std::min<size_t>(cy*2 + 2, fine.dim.y); ++y)
+							for(size_t z = cz*2; z < std::min<size_t>(cz*2 + 2, fine.dim.z); ++z)
+							{
+								const range_t& f = fine[glm::uvec3(x, y, z)];
+								r.min = std::min(r.min, f.min);
+								r.max = std::max(r.max, f.max);
+							}
+
+					coarse[glm::uvec3(cx, cy, cz)] = r;
+				}
+	}
+
+	static glm::vec3 voxel_scale()
+	{
+		return glm::vec3(X - 1, Y - 1, Z - 1);
+	}
+
+public:
+	density_pyramid(const volume<D, X, Y, Z>& dust)
+	: m_levels()
+	{
+		m_levels.push_back(create_level(base_block));
+		build_base(dust);
+
+		while(m_levels.back().dim.x > 1 || m_levels.back().dim.y > 1 || m_levels.back().dim.z > 1)
+		{
+			m_levels.push_back(create_level(m_levels.back().block * 2));
+			build_level(m_levels[m_levels.size()-2], m_levels.back());
+		}
+	}
+
+	size_t level_count() const
+	{
+		return m_levels.size();
+	}
+
+	const level_t& level(const size_t i) const
+	{
+		return m_levels[i];
+	}
+
+	/*
+	 * Distance along the normalized direction dir from fpos to the exit of the largest cell containing fpos
+	 * whose maximum density is at most threshold. Returns 0 when fpos is not in such a cell.
+	 *
+	 * Cells are shrunk by margin voxels on every side; use a margin of 0.5 for samplers that read neighbouring voxels (trilinear).
+	 */
+	GLfloat empty_distance(const glm::vec3& fpos, const glm::vec3& dir, const GLfloat threshold = 0.0f, const GLfloat margin = 0.0f) const
+	{
+		const glm::vec3 scale = voxel_scale();
+		const glm::vec3 vpos = fpos * scale; // Continuous voxel coordinates, voxel i spans [i-0.5, i+0.5)
+
+		for(size_t i = 0; i < 3; ++i)
+			if(vpos[i] < -0.5f || vpos[i] >= scale[i] + 0.5f)
+				return 0.0f;
+
+		const glm::vec3 rounded = glm::floor(vpos + glm::vec3(0.5f)); // Not round, which takes -0.5 to voxel -1
+		const glm::uvec3 voxel(rounded.x, rounded.y, rounded.z);
+
+		for(size_t l = m_levels.size(); l-- > 0;)
+		{
+			const level_t& lvl = m_levels[l];
+			const glm::uvec3 cell(voxel.x / lvl.block, voxel.y / lvl.block, voxel.z / lvl.block);
+
+			if(lvl[cell].max > threshold)
+				continue;
+
+			bool inside = true;
+			GLfloat t = std::numeric_limits<GLfloat>::max();
+			for(size_t i = 0; i < 3; ++i)
+			{
+				const GLfloat lower = (GLfloat)(cell[i] * lvl.block) - 0.5f + margin;
+				const GLfloat upper = (GLfloat)((cell[i] + 1) * lvl.block) - 0.5f - margin;
+
+				if(vpos[i] < lower || vpos[i] > upper)
+				{
+					inside = false;
+					break;
+				}
+
+				if(dir[i] == 0.0f)
+					continue;
+
+				const GLfloat bound = dir[i] > 0.0f ? upper : lower;
+				t = std::min(t, (bound - vpos[i]) / (dir[i] * scale[i]));
+			}
+
+			if(inside)
+				return t;
+		}
+
+		return 0.0f;
+	}
+
+	/*
+	 * Whether a cell of a level and its neighbours are all empty, so that no trilinear sample blends a voxel of the cell
+	 * with dust; what such voxels hold besides their zero density never shows
+	 */
+	bool empty_around(const size_t l, const glm::uvec3& cell) const
+	{
+		const level_t& lvl = m_levels[l];
+		const glm::uvec3 lo = glm::max(cell, glm::uvec3(1)) - glm::uvec3(1), hi = glm::min(cell + glm::uvec3(1), lvl.dim - glm::uvec3(1));
+
+		for(size_t x = lo.x; x <= hi.x; ++x)
+			for(size_t y = lo.y; y <= hi.y; ++y)
+				for(size_t z = lo.z; z <= hi.z; ++z)
+					if(lvl[glm::uvec3(x, y, z)].max > 0.0f)
+						return false;
+
+		return true;
+	}
+
+	/* Maximum density per cell of a level as 8-bit texels, rounded up so that occupied cells never read as empty */
+	std::vector<GLubyte> to_texture_data(const size_t l) const
+	{
+		const level_t& lvl = m_levels[l];
+		std::vector<GLubyte> data(lvl.cells.size());
+
+		// Textures are indexed with x fastest, the volume with z fastest; the shader mirrors (zyx) accordingly
+		for(size_t x = 0; x < lvl.dim.x; ++x)
+			for(size_t y = 0; y < lvl.dim.y; ++y)
+				for(size_t z = 0; z < lvl.dim.z; ++z)
+					data[x * lvl.dim.y * lvl.dim.z + y * lvl.dim.z + z] = std::ceil(glm::clamp(lvl[glm::uvec3(x, y, z)].max, 0.0f, 1.0f) * 255.0f);
+
+		return data;
+	}
+};
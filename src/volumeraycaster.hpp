@@ -0,0 +1,261 @@
+#pragma once
+
+#include <limits>
+#include <algorithm>
+
+#include "nebula.hpp"
+#include "volumepyramid.hpp"
+#include "volumesampler.hpp"
+
+#include "util/image.hpp"
+#include "util/parallel.hpp"
+#include "util/trace.hpp"
+
+/*
+ * CPU implementation of nebularaycast.fragmentshader, for rendering without a GPU and as a reference for the GPU path.
+ * Composites front to back with the same step size, density and colour model, samples like a GL_LINEAR texture with a
+ * transparent border, and draws the stars on top as the volume scene does. Every step is sampled, as the shader does
+ * with --raycast-thin-stride 1; its default stride through thin dust trades some accuracy for speed.
+ *
+ * Tiles of the image are rendered in parallel. Within a tile, rays are marched in packets that sample in lockstep, stop
+ * once opaque, and jump over the empty cells of a density pyramid.
+ */
+template<size_t X, size_t Y, size_t Z, typename D = glm::vec4>
+class volume_raycaster
+{
+public:
+	static constexpr size_t tile_size = 16; // Pixels per tile edge
+	static constexpr size_t packet_size = 8; // Rays marched together, neighbours on a row
+
+private:
+	// As in the shader
+	static constexpr GLfloat stepsize = 0.001f;
+	static constexpr GLfloat particle_density = 4.0f * stepsize;
+	static constexpr GLfloat color_intensity = 2.0f;
+	static constexpr GLfloat color_modifier = particle_density * color_intensity;
+
+	struct ray_t
+	{
+		glm::vec3 pos; // Texture coordinates, which are those of the unit cube
+		glm::vec3 delta; // One step
+		size_t step, steps;
+
+		glm::vec3 sampler_dir; // Direction in the space of the sampler and pyramid
+		GLfloat sampler_scale; // Distance in texture coordinates per unit of distance in that space
+
+		glm::vec4 color;
+		GLfloat transmittance; // alpha_res in the shader
+		bool probe; // The last sample was empty, so look for empty space before the next
+	};
+
+	const volume_nebula_t<X, Y, Z, D>& m_nebula;
+	const volume_sampler<D, X, Y, Z> m_sampler;
+	const density_pyramid<X, Y, Z, D> m_pyramid;
+
+	/* GL places texel i at (i + 0.5) / N, the sampler at i / (N - 1) */
+	static glm::vec3 texel_scale()
+	{
+		return glm::vec3((GLfloat)X / (X - 1), (GLfloat)Y / (Y - 1), (GLfloat)Z / (Z - 1));
+	}
+
+	static glm::vec3 to_sampler(const glm::vec3& tpos)
+	{
+		return tpos * texel_scale() - glm::vec3(0.5f / (X - 1), 0.5f / (Y - 1), 0.5f / (Z - 1));
+	}
+
+	static uint8_t to_unorm8(const GLfloat v)
+	{
+		return glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f;
+	}
+
+	/* Ray from eye along the normalized dir, clipped to the unit cube; false if it misses the cube */
+	static bool setup_ray(ray_t& r, const glm::vec3& eye, const glm::vec3& dir)
+	{
+		GLfloat t_near = 0.0f, t_far = std::numeric_limits<GLfloat>::max();
+		for(size_t i = 0; i < 3; ++i)
+		{
+			if(dir[i] == 0.0f)
+			{
+				if(eye[i] < 0.0f || eye[i] > 1.0f)
+					return false;
+
+				continue;
+			}
+
+			const GLfloat t0 = -eye[i] / dir[i], t1 = (1.0f - eye[i]) / dir[i];
+			t_near = std::max(t_near, std::min(t0, t1));
+			t_far = std::min(t_far, std::max(t0, t1));
+		}
+
+		if(t_near >= t_far)
+			return false;
+
+		const glm::vec3 sampler_delta = dir * texel_scale();
+
+		r.pos = eye + dir * t_near;
+		r.delta = dir * stepsize;
+		r.step = 0;
+		r.steps = (t_far - t_near) / stepsize;
+		r.sampler_dir = glm::normalize(sampler_delta);
+		r.sampler_scale = 1.0f / glm::length(sampler_delta);
+		r.color = glm::vec4(0.0f);
+		r.transmittance = 1.0f;
+		r.probe = true;
+		return true;
+	}
+
+	/* Whole steps ahead of r that only sample empty space */
+	size_t empty_steps(const ray_t& r) const
+	{
+		const GLfloat distance = m_pyramid.empty_distance(to_sampler(r.pos), r.sampler_dir, 0.0f, 0.5f) * r.sampler_scale;
+		return std::min<size_t>(distance / stepsize, r.steps - r.step);
+	}
+
+	/* Marches n rays until all are opaque or have left the volume, one sample of every live ray per round */
+	void march(ray_t* rays, const size_t n) const
+	{
+		GLfloat xs[packet_size], ys[packet_size], zs[packet_size], alphas[packet_size];
+		size_t lanes[packet_size];
+
+		while(true)
+		{
+			size_t m = 0;
+			for(size_t l = 0; l < n; ++l)
+			{
+				ray_t& r = rays[l];
+				if(r.step < r.steps && r.probe)
+				{
+					const size_t skip = empty_steps(r);
+					r.step += skip;
+					r.pos += r.delta * (GLfloat)skip;
+					r.probe = false;
+				}
+
+				if(r.step >= r.steps)
+					continue;
+
+				const glm::vec3 spos = to_sampler(r.pos);
+				xs[m] = spos.x;
+				ys[m] = spos.y;
+				zs[m] = spos.z;
+				lanes[m++] = l;
+			}
+
+			if(m == 0)
+				return;
+
+			// Density first; the colour only matters where there is any
+			m_sampler.alpha_trilinear(xs, ys, zs, alphas, m);
+
+			for(size_t j = 0; j < m; ++j)
+			{
+				ray_t& r = rays[lanes[j]];
+				if(alphas[j] > 0.0f)
+				{
+					const glm::vec4 sample = m_sampler.trilinear(glm::vec3(xs[j], ys[j], zs[j]));
+					r.color += sample * (sample.a * r.transmittance * color_modifier);
+					r.transmittance -= sample.a * particle_density;
+				}
+
+				r.pos += r.delta;
+				++r.step;
+				r.probe = alphas[j] <= 0.0f;
+
+				if(r.transmittance <= 0.0f)
+					r.step = r.steps; // Opaque
+			}
+		}
+	}
+
+	void render_tile(rgb_image& image, const glm::mat4& inverse_mvp, const glm::vec3& eye, const size_t x_begin, const size_t y_begin) const
+	{
+		const size_t x_end = std::min(x_begin + tile_size, image.width), y_end = std::min(y_begin + tile_size, image.height);
+
+		ray_t rays[packet_size];
+		size_t pixels[packet_size];
+
+		for(size_t y = y_begin; y < y_end; ++y)
+			for(size_t x0 = x_begin; x0 < x_end; x0 += packet_size)
+			{
+				size_t n = 0;
+				for(size_t x = x0; x < std::min(x0 + packet_size, x_end); ++x)
+				{
+					const GLfloat ndc_x = ((GLfloat)x + 0.5f) / image.width * 2.0f - 1.0f;
+					const GLfloat ndc_y = 1.0f - ((GLfloat)y + 0.5f) / image.height * 2.0f; // Rows from the top
+
+					const glm::vec4 near = inverse_mvp * glm::vec4(ndc_x, ndc_y, -1.0f, 1.0f);
+					const glm::vec4 far = inverse_mvp * glm::vec4(ndc_x, ndc_y, 1.0f, 1.0f);
+					const glm::vec3 dir = glm::normalize(glm::vec3(far.x, far.y, far.z) / far.w - glm::vec3(near.x, near.y, near.z) / near.w);
+
+					if(setup_ray(rays[n], eye, dir))
+						pixels[n++] = x;
+				}
+
+				march(rays, n);
+
+				for(size_t i = 0; i < n; ++i)
+				{
+					uint8_t* p = image.pixel(pixels[i], y);
+					p[0] = to_unorm8(rays[i].color.r);
+					p[1] = to_unorm8(rays[i].color.g);
+					p[2] = to_unorm8(rays[i].color.b);
+				}
+			}
+	}
+
+	/* Stars as squares of five pixels over the volume, like the GL points of the volume scene */
+	void draw_stars(rgb_image& image, const glm::mat4& mvp) const
+	{
+		for(const star_t& star : m_nebula.stars)
+		{
+			const glm::vec4 p = mvp * glm::vec4(star.pos.x, star.pos.y, star.pos.z, 1.0f);
+			if(p.w <= 0.0f || std::abs(p.x) > p.w || std::abs(p.y) > p.w || std::abs(p.z) > p.w)
+				continue; // Clipped
+
+			const GLfloat cx = (p.x / p.w + 1.0f) * 0.5f * image.width;
+			const GLfloat cy = (1.0f - p.y / p.w) * 0.5f * image.height;
+
+			// Pixels whose centers lie within the square
+			const int x_begin = std::max<int>(std::ceil(cx - 3.0f), 0), x_end = std::min<int>(std::ceil(cx + 2.0f), image.width);
+			const int y_begin = std::max<int>(std::ceil(cy - 3.0f), 0), y_end = std::min<int>(std::ceil(cy + 2.0f), image.height);
+
+			for(int y = y_begin; y < y_end; ++y)
+				for(int x = x_begin; x < x_end; ++x)
+				{
+					uint8_t* q = image.pixel(x, y);
+					q[0] = to_unorm8(star.color.r);
+					q[1] = to_unorm8(star.color.g);
+					q[2] = to_unorm8(star.color.b);
+				}
+		}
+	}
+
+public:
+	volume_raycaster(const volume_nebula_t<X, Y, Z, D>& nebula)
+	: m_nebula(nebula)
+	, m_sampler(nebula.dust, address_mode::border)
+	, m_pyramid(nebula.dust)
+	{}
+
+	/*
+	 * Renders the volume into image, black where no ray hits it. mvp maps the unit cube of the volume to clip space,
+	 * eye is the camera position relative to the cube; both as the shader receives them.
+	 */
+	void render(rgb_image& image, const glm::mat4& mvp, const glm::vec3& eye) const
+	{
+		trace::zone zone("cpu raycast");
+
+		std::fill(image.data.begin(), image.data.end(), 0);
+
+		const glm::mat4 inverse_mvp = glm::inverse(mvp);
+		const size_t tiles_x = (image.width + tile_size - 1) / tile_size;
+		const size_t tiles_y = (image.height + tile_size - 1) / tile_size;
+
+		// Tiles through dense dust take far longer than empty ones, hence the stealing
+		parallel_for_stealing(0, tiles_x * tiles_y, [&](const size_t t) {
+			render_tile(image, inverse_mvp, eye, (t % tiles_x) * tile_size, (t / tiles_x) * tile_size);
+		});
+
+		draw_stars(image, mvp);
+	}
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "volume.hpp"
+#include "voxel.hpp"
+
+#include "gl/gl.hpp"
+
+/* How fetches outside of the volume are resolved */
+enum class address_mode
+{
+	clamp, // Repeat the edge voxel
+	border // Return the border value
+};
+
+namespace detail
+{
+	/* Layout of the alpha channel for the AVX2 gather path; supported only where alpha is a plain 32-bit lane */
+	template<typename T>
+	struct alpha_gather
+	{
+		static constexpr bool supported = false;
+	};
+
+	template<>
+	struct alpha_gather<GLfloat>
+	{
+		static constexpr bool supported = true;
+	};
+
+	template<>
+	struct alpha_gather<glm::vec4>
+	{
+		static constexpr bool supported = true;
+	};
+
+	template<>
+	struct alpha_gather<rgba8_t>
+	{
+		static constexpr bool supported = true;
+	};
+}
+
+/*
+ * Filtered reads from a dense volume, in the normalized [0, 1] space of density_pyramid where voxel i lies at i / (N-1).
+ * Values are decoded with voxel_value, so GLfloat and glm::vec3 volumes sample as themselves and all others as glm::vec4.
+ *
+ * The batched forms take positions as separate x, y and z arrays and are the preferred interface for ray marchers.
+ */
+template<typename T, size_t X, size_t Y, size_t Z>
+class volume_sampler
+{
+public:
+	typedef decltype(voxel_value(std::declval<T>())) value_t;
+
+private:
+	const volume<T, X, Y, Z>& m_volume;
+	address_mode m_mode;
+	value_t m_border;
+
+	static constexpr GLfloat sX = X - 1, sY = Y - 1, sZ = Z - 1;
+
+	static size_t index(const size_t x, const size_t y, const size_t z)
+	{
+		return x * Y * Z + y * Z + z;
+	}
+
+	static int clamp_index(const int i, const size_t n)
+	{
+		return i < 0 ? 0 : (i >= (int)n ? (int)n - 1 : i);
+	}
+
+	static bool in_range(const int i, const size_t n)
+	{
+		return i >= 0 && i < (int)n;
+	}
+
+	template<typename F>
+	static auto lerp(const F& a, const F& b, const GLfloat t) -> decltype(a + (b - a) * t)
+	{
+		return a + (b - a) * t;
+	}
+
+	/* Lowest corner of the 2x2x2 footprint and the interpolation weights */
+	static void footprint(const GLfloat fx, const GLfloat fy, const GLfloat fz, glm::ivec3& base, glm::vec3& w)
+	{
+		const glm::vec3 vpos(fx * sX, fy * sY, fz * sZ);
+		const glm::vec3 f = glm::floor(vpos);
+
+		base = glm::ivec3(f.x, f.y, f.z);
+		w = vpos - f;
+	}
+
+	GLfloat fetch_alpha(const int x, const int y, const int z) const
+	{
+		if(m_mode == address_mode::border && !(in_range(x, X) && in_range(y, Y) && in_range(z, Z)))
+			return voxel_alpha(m_border);
+
+		return voxel_alpha(m_volume.data()[index(clamp_index(x, X), clamp_index(y, Y), clamp_index(z, Z))]);
+	}
+
+	void alpha_trilinear_batch(const GLfloat* xs, const GLfloat* ys, const GLfloat* zs, GLfloat* out, const size_t n, std::false_type) const
+	{
+		for(size_t i = 0; i < n; ++i)
+			out[i] = alpha_trilinear(glm::vec3(xs[i], ys[i], zs[i]));
+	}
+
+	void alpha_trilinear_batch(const GLfloat* xs, const GLfloat* ys, const GLfloat* zs, GLfloat* out, const size_t n, std::true_type) const
+	{
+#ifdef __AVX2__
+		size_t i = 0;
+		for(; i + 8 <= n; i += 8)
+			_mm256_storeu_ps(out + i, alpha_trilinear8(xs + i, ys + i, zs + i));
+
+		alpha_trilinear_batch(xs + i, ys + i, zs + i, out + i, n - i, std::false_type());
+#else
+		alpha_trilinear_batch(xs, ys, zs, out, n, std::false_type());
+#endif
+	}
+
+#ifdef __AVX2__
+	/* Gathers the alpha of eight voxels by linear index */
+	static __m256 gather_alpha(const GLfloat* base, const __m256i idx, GLfloat)
+	{
+		return _mm256_i32gather_ps(base, idx, 4);
+	}
+
+	static __m256 gather_alpha(const GLfloat* base, const __m256i idx, glm::vec4)
+	{
+		static_assert(sizeof(glm::vec4) == 4*sizeof(GLfloat), "glm::vec4 must be tightly packed");
+		return _mm256_i32gather_ps(base + 3, _mm256_slli_epi32(idx, 2), 4);
+	}
+
+	static __m256 gather_alpha(const GLfloat* base, const __m256i idx, rgba8_t)
+	{
+		static_assert(sizeof(rgba8_t) == 4, "rgba8_t must be tightly packed");
+		const __m256i words = _mm256_i32gather_epi32((const int*)base, idx, 4);
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(words, 24)), _mm256_set1_ps(1.0f / 255.0f));
+	}
+
+	/* Keeps the corners of c that lie inside the volume on every axis and replaces the others with border */
+	static __m256 border_mask(const __m256 c, const __m256 border, const __m256i in_x, const __m256i in_y, const __m256i in_z)
+	{
+		return _mm256_blendv_ps(border, c, _mm256_castsi256_ps(_mm256_and_si256(_mm256_and_si256(in_x, in_y), in_z)));
+	}
+
+	/* Eight trilinear alpha samples at once */
+	__m256 alpha_trilinear8(const GLfloat* xs, const GLfloat* ys, const GLfloat* zs) const
+	{
+		const GLfloat* base = (const GLfloat*)m_volume.data();
+
+		const __m256 vx = _mm256_mul_ps(_mm256_loadu_ps(xs), _mm256_set1_ps(sX));
+		const __m256 vy = _mm256_mul_ps(_mm256_loadu_ps(ys), _mm256_set1_ps(sY));
+		const __m256 vz = _mm256_mul_ps(_mm256_loadu_ps(zs), _mm256_set1_ps(sZ));
+
+		const __m256 flx = _mm256_floor_ps(vx), fly = _mm256_floor_ps(vy), flz = _mm256_floor_ps(vz);
+		const __m256 wx = _mm256_sub_ps(vx, flx), wy = _mm256_sub_ps(vy, fly), wz = _mm256_sub_ps(vz, flz);
+
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i mx = _mm256_set1_epi32(X - 1), my = _mm256_set1_epi32(Y - 1), mz = _mm256_set1_epi32(Z - 1);
+
+		const __m256i ix = _mm256_cvtps_epi32(flx), iy = _mm256_cvtps_epi32(fly), iz = _mm256_cvtps_epi32(flz);
+		const __m256i x0 = _mm256_min_epi32(_mm256_max_epi32(ix, zero), mx), x1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(ix, one), zero), mx);
+		const __m256i y0 = _mm256_min_epi32(_mm256_max_epi32(iy, zero), my), y1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(iy, one), zero), my);
+		const __m256i z0 = _mm256_min_epi32(_mm256_max_epi32(iz, zero), mz), z1 = _mm256_min_epi32(_mm256_max_epi32(_mm256_add_epi32(iz, one), zero), mz);
+
+		const __m256i sx = _mm256_set1_epi32(Y * Z), sy = _mm256_set1_epi32(Z);
+		const __m256i ox0 = _mm256_mullo_epi32(x0, sx), ox1 = _mm256_mullo_epi32(x1, sx);
+		const __m256i oy0 = _mm256_mullo_epi32(y0, sy), oy1 = _mm256_mullo_epi32(y1, sy);
+
+		const T tag = T();
+		__m256 c000 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox0, oy0), z0), tag);
+		__m256 c001 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox0, oy0), z1), tag);
+		__m256 c010 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox0, oy1), z0), tag);
+		__m256 c011 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox0, oy1), z1), tag);
+		__m256 c100 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox1, oy0), z0), tag);
+		__m256 c101 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox1, oy0), z1), tag);
+		__m256 c110 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox1, oy1), z0), tag);
+		__m256 c111 = gather_alpha(base, _mm256_add_epi32(_mm256_add_epi32(ox1, oy1), z1), tag);
+
+		if(m_mode == address_mode::border)
+		{
+			// A corner is inside when clamping left its index unchanged
+			const __m256 border = _mm256_set1_ps(voxel_alpha(m_border));
+			const __m256i in_x0 = _mm256_cmpeq_epi32(x0, ix), in_x1 = _mm256_cmpeq_epi32(x1, _mm256_add_epi32(ix, one));
+			const __m256i in_y0 = _mm256_cmpeq_epi32(y0, iy), in_y1 = _mm256_cmpeq_epi32(y1, _mm256_add_epi32(iy, one));
+			const __m256i in_z0 = _mm256_cmpeq_epi32(z0, iz), in_z1 = _mm256_cmpeq_epi32(z1, _mm256_add_epi32(iz, one));
+
+			c000 = border_mask(c000, border, in_x0, in_y0, in_z0);
+			c001 = border_mask(c001, border, in_x0, in_y0, in_z1);
+			c010 = border_mask(c010, border, in_x0, in_y1, in_z0);
+			c011 = border_mask(c011, border, in_x0, in_y1, in_z1);
+			c100 = border_mask(c100, border, in_x1, in_y0, in_z0);
+			c101 = border_mask(c101, border, in_x1, in_y0, in_z1);
+			c110 = border_mask(c110, border, in_x1, in_y1, in_z0);
+			c111 = border_mask(c111, border, in_x1, in_y1, in_z1);
+		}
+
+		// a + (b - a) * t, innermost along z to match the scalar path
+		const __m256 c00 = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c001, c000), wz), c000);
+		const __m256 c01 = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c011, c010), wz), c010);
+		const __m256 c10 = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c101, c100), wz), c100);
+		const __m256 c11 = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c111, c110), wz), c110);
+
+		const __m256 c0 = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c01, c00), wy), c00);
+		const __m256 c1 = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c11, c10), wy), c10);
+
+		return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(c1, c0), wx), c0);
+	}
+#endif
+
+public:
+	volume_sampler(const volume<T, X, Y, Z>& v, const address_mode mode = address_mode::clamp, const value_t border = value_t())
+	: m_volume(v)
+	, m_mode(mode)
+	, m_border(border)
+	{}
+
+	/* Decoded voxel at integer coordinates, resolved with the addressing mode */
+	value_t fetch(const int x, const int y, const int z) const
+	{
+		if(m_mode == address_mode::border && !(in_range(x, X) && in_range(y, Y) && in_range(z, Z)))
+			return m_border;
+
+		return voxel_value(m_volume.data()[index(clamp_index(x, X), clamp_index(y, Y), clamp_index(z, Z))]);
+	}
+
+	value_t nearest(const glm::vec3& fpos) const
+	{
+		return fetch(std::floor(fpos.x * sX + 0.5f), std::floor(fpos.y * sY + 0.5f), std::floor(fpos.z * sZ + 0.5f));
+	}
+
+	value_t trilinear(const glm::vec3& fpos) const
+	{
+		glm::ivec3 b;
+		glm::vec3 w;
+		footprint(fpos.x, fpos.y, fpos.z, b, w);
+
+		const value_t c00 = lerp(fetch(b.x, b.y, b.z), fetch(b.x, b.y, b.z+1), w.z);
+		const value_t c01 = lerp(fetch(b.x, b.y+1, b.z), fetch(b.x, b.y+1, b.z+1), w.z);
+		const value_t c10 = lerp(fetch(b.x+1, b.y, b.z), fetch(b.x+1, b.y, b.z+1), w.z);
+		const value_t c11 = lerp(fetch(b.x+1, b.y+1, b.z), fetch(b.x+1, b.y+1, b.z+1), w.z);
+
+		return lerp(lerp(c00, c01, w.y), lerp(c10, c11, w.y), w.x);
+	}
+
+	/* Trilinear density only; avoids decoding the colour channels */
+	GLfloat alpha_trilinear(const glm::vec3& fpos) const
+	{
+		glm::ivec3 b;
+		glm::vec3 w;
+		footprint(fpos.x, fpos.y, fpos.z, b, w);
+
+		const GLfloat c00 = lerp(fetch_alpha(b.x, b.y, b.z), fetch_alpha(b.x, b.y, b.z+1), w.z);
+		const GLfloat c01 = lerp(fetch_alpha(b.x, b.y+1, b.z), fetch_alpha(b.x, b.y+1, b.z+1), w.z);
+		const GLfloat c10 = lerp(fetch_alpha(b.x+1, b.y, b.z), fetch_alpha(b.x+1, b.y, b.z+1), w.z);
+		const GLfloat c11 = lerp(fetch_alpha(b.x+1, b.y+1, b.z), fetch_alpha(b.x+1, b.y+1, b.z+1), w.z);
+
+		return lerp(lerp(c00, c01, w.y), lerp(c10, c11, w.y), w.x);
+	}
+
+	void trilinear(const GLfloat* xs, const GLfloat* ys, const GLfloat* zs, value_t* out, const size_t n) const
+	{
+		for(size_t i = 0; i < n; ++i)
+			out[i] = trilinear(glm::vec3(xs[i], ys[i], zs[i]));
+	}
+
+	/* Batched density; eight lanes at a time with AVX2 gathers where the voxel type allows it */
+	void alpha_trilinear(const GLfloat* xs, const GLfloat* ys, const GLfloat* zs, GLfloat* out, const size_t n) const
+	{
+		alpha_trilinear_batch(xs, ys, zs, out, n, std::integral_constant<bool, detail::alpha_gather<T>::supported>());
+	}
+};
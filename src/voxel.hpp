@@ -0,0 +1,338 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <msgpack.hpp>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include "volume.hpp"
+#include "util/msgpack_blob.hpp"
+
+#include "gl/gl.hpp"
+
+/*
+ * Compact voxel storage types. Every type has a voxel_codec which maps it from and to glm::vec4,
+ * the type in which all computation is done. Single channel types only store density (alpha).
+ */
+
+struct rgba8_t
+{
+	uint8_t r, g, b, a;
+
+	MSGPACK_DEFINE(r, g, b, a)
+};
+
+struct rgba16f_t
+{
+	uint16_t r, g, b, a;
+
+	MSGPACK_DEFINE(r, g, b, a)
+};
+
+struct r8_t
+{
+	uint8_t a;
+
+	MSGPACK_DEFINE(a)
+};
+
+struct r16_t
+{
+	uint16_t a;
+
+	MSGPACK_DEFINE(a)
+};
+
+MSGPACK_BLOB_TYPE(rgba8_t, 1)
+MSGPACK_BLOB_TYPE(rgba16f_t, 2)
+MSGPACK_BLOB_TYPE(r8_t, 1)
+MSGPACK_BLOB_TYPE(r16_t, 2)
+
+static inline uint8_t unorm8_encode(const GLfloat x)
+{
+	return glm::clamp(x, 0.0f, 1.0f) * 255.0f + 0.5f;
+}
+
+static inline GLfloat unorm8_decode(const uint8_t x)
+{
+	return x * (1.0f / 255.0f);
+}
+
+static inline uint16_t unorm16_encode(const GLfloat x)
+{
+	return glm::clamp(x, 0.0f, 1.0f) * 65535.0f + 0.5f;
+}
+
+static inline GLfloat unorm16_decode(const uint16_t x)
+{
+	return x * (1.0f / 65535.0f);
+}
+
+static inline uint16_t half_encode(const GLfloat x)
+{
+#ifdef __F16C__
+	return _cvtss_sh(x, 0);
+#else
+	uint32_t f;
+	std::memcpy(&f, &x, sizeof(f));
+
+	const uint16_t sign = (f >> 16) & 0x8000;
+	const int32_t exponent = ((f >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = f & 0x007fffff;
+
+	if(((f >> 23) & 0xff) == 0xff) // Inf or NaN
+		return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+	if(exponent >= 0x1f) // Overflow to Inf
+		return sign | 0x7c00;
+
+	if(exponent <= 0) // Subnormal or zero
+	{
+		if(exponent < -10)
+			return sign;
+
+		mantissa |= 0x00800000;
+		const uint32_t shift = 14 - exponent;
+		const uint32_t rounded = (mantissa + (1u << (shift - 1)) - 1 + ((mantissa >> shift) & 1)) >> shift;
+		return sign | rounded;
+	}
+
+	// Round to nearest even; a carry into the exponent is handled by the addition
+	const uint32_t rounded = ((exponent << 10) | (mantissa >> 13)) + (((mantissa & 0x1fff) + ((mantissa >> 13) & 1)) > 0x1000 ? 1 : 0);
+	return sign | rounded;
+#endif
+}
+
+static inline GLfloat half_decode(const uint16_t h)
+{
+#ifdef __F16C__
+	return _cvtsh_ss(h);
+#else
+	const uint32_t sign = (h & 0x8000) << 16;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+
+	uint32_t f;
+	if(exponent == 0x1f)
+		f = sign | 0x7f800000 | (mantissa << 13);
+	else if(exponent == 0)
+	{
+		if(mantissa == 0)
+			f = sign;
+		else
+		{
+			// Renormalize the subnormal
+			exponent = 127 - 15 + 1;
+			while((mantissa & 0x400) == 0)
+			{
+				mantissa <<= 1;
+				--exponent;
+			}
+
+			f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+		}
+	}
+	else
+		f = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+	GLfloat result;
+	std::memcpy(&result, &f, sizeof(result));
+	return result;
+#endif
+}
+
+template<typename T>
+struct voxel_codec;
+
+template<>
+struct voxel_codec<glm::vec4>
+{
+	static glm::vec4 decode(const glm::vec4& v) { return v; }
+	static glm::vec4 encode(const glm::vec4& v) { return v; }
+	static GLfloat alpha(const glm::vec4& v) { return v.a; }
+};
+
+template<>
+struct voxel_codec<glm::vec3>
+{
+	static glm::vec4 decode(const glm::vec3& v) { return glm::vec4(v.r, v.g, v.b, 0.0f); }
+	static glm::vec3 encode(const glm::vec4& v) { return glm::vec3(v.r, v.g, v.b); }
+	static GLfloat alpha(const glm::vec3&) { return 0.0f; }
+};
+
+template<>
+struct voxel_codec<rgba8_t>
+{
+	static glm::vec4 decode(const rgba8_t& v)
+	{
+		return glm::vec4(unorm8_decode(v.r), unorm8_decode(v.g), unorm8_decode(v.b), unorm8_decode(v.a));
+	}
+
+	static rgba8_t encode(const glm::vec4& v)
+	{
+		return {unorm8_encode(v.r), unorm8_encode(v.g), unorm8_encode(v.b), unorm8_encode(v.a)};
+	}
+
+	static GLfloat alpha(const rgba8_t& v) { return unorm8_decode(v.a); }
+};
+
+template<>
+struct voxel_codec<rgba16f_t>
+{
+	static glm::vec4 decode(const rgba16f_t& v)
+	{
+		return glm::vec4(half_decode(v.r), half_decode(v.g), half_decode(v.b), half_decode(v.a));
+	}
+
+	static rgba16f_t encode(const glm::vec4& v)
+	{
+		return {half_encode(v.r), half_encode(v.g), half_encode(v.b), half_encode(v.a)};
+	}
+
+	static GLfloat alpha(const rgba16f_t& v) { return half_decode(v.a); }
+};
+
+template<>
+struct voxel_codec<r8_t>
+{
+	static glm::vec4 decode(const r8_t& v) { return glm::vec4(0.0f, 0.0f, 0.0f, unorm8_decode(v.a)); }
+	static r8_t encode(const glm::vec4& v) { return {unorm8_encode(v.a)}; }
+	static GLfloat alpha(const r8_t& v) { return unorm8_decode(v.a); }
+};
+
+template<>
+struct voxel_codec<r16_t>
+{
+	static glm::vec4 decode(const r16_t& v) { return glm::vec4(0.0f, 0.0f, 0.0f, unorm16_decode(v.a)); }
+	static r16_t encode(const glm::vec4& v) { return {unorm16_encode(v.a)}; }
+	static GLfloat alpha(const r16_t& v) { return unorm16_decode(v.a); }
+};
+
+/* Decoded value of a voxel: GLfloat and glm::vec3 are kept as they are, all other types decode to glm::vec4 */
+static inline GLfloat voxel_value(const GLfloat v) { return v; }
+static inline glm::vec3 voxel_value(const glm::vec3& v) { return v; }
+
+template<typename T>
+glm::vec4 voxel_value(const T& v)
+{
+	return voxel_codec<T>::decode(v);
+}
+
+static inline GLfloat voxel_alpha(const GLfloat v) { return v; }
+
+template<typename T>
+GLfloat voxel_alpha(const T& v)
+{
+	return voxel_codec<T>::alpha(v);
+}
+
+template<typename T>
+struct voxel_store
+{
+	static T apply(const glm::vec4& v) { return voxel_codec<T>::encode(v); }
+};
+
+template<>
+struct voxel_store<GLfloat>
+{
+	static GLfloat apply(const GLfloat v) { return v; }
+};
+
+template<>
+struct voxel_store<glm::vec3>
+{
+	static glm::vec3 apply(const glm::vec3& v) { return v; }
+};
+
+/* Bulk conversions; plain loops over the codecs that the compiler can vectorize, with an F16C path for half floats */
+template<typename T>
+void voxel_encode(const glm::vec4* src, T* dst, const size_t n)
+{
+	for(size_t i = 0; i < n; ++i)
+		dst[i] = voxel_codec<T>::encode(src[i]);
+}
+
+template<typename T>
+void voxel_decode(const T* src, glm::vec4* dst, const size_t n)
+{
+	for(size_t i = 0; i < n; ++i)
+		dst[i] = voxel_codec<T>::decode(src[i]);
+}
+
+#ifdef __F16C__
+template<>
+inline void voxel_encode<rgba16f_t>(const glm::vec4* src, rgba16f_t* dst, const size_t n)
+{
+	static_assert(sizeof(glm::vec4) == 4*sizeof(float) && sizeof(rgba16f_t) == 4*sizeof(uint16_t), "Voxel types must be tightly packed");
+
+	size_t i = 0;
+	for(; i + 2 <= n; i += 2) // Two voxels per 256-bit conversion
+	{
+		const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(&src[i].x), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)&dst[i], h);
+	}
+
+	for(; i < n; ++i)
+		dst[i] = voxel_codec<rgba16f_t>::encode(src[i]);
+}
+
+template<>
+inline void voxel_decode<rgba16f_t>(const rgba16f_t* src, glm::vec4* dst, const size_t n)
+{
+	size_t i = 0;
+	for(; i + 2 <= n; i += 2)
+		_mm256_storeu_ps(&dst[i].x, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)&src[i])));
+
+	for(; i < n; ++i)
+		dst[i] = voxel_codec<rgba16f_t>::decode(src[i]);
+}
+#endif
+
+/* Converts between any two voxel types, in chunks through a small float buffer */
+template<typename To, typename From>
+void voxel_convert(const From* src, To* dst, const size_t n)
+{
+	static constexpr size_t chunk = 1024;
+	glm::vec4 buffer[chunk];
+
+	for(size_t i = 0; i < n; i += chunk)
+	{
+		const size_t len = std::min(chunk, n - i);
+		voxel_decode(src + i, buffer, len);
+		voxel_encode(buffer, dst + i, len);
+	}
+}
+
+template<typename T>
+void voxel_convert(const T* src, T* dst, const size_t n)
+{
+	std::copy(src, src + n, dst);
+}
+
+/* Voxels of src as To, for uploads: src itself when it already holds To, otherwise a conversion into buffer */
+template<typename To, typename From>
+const To* voxel_view(const From* src, std::vector<To>& buffer, const size_t n)
+{
+	buffer.resize(n);
+	voxel_convert(src, buffer.data(), n);
+	return buffer.data();
+}
+
+template<typename T>
+const T* voxel_view(const T* src, std::vector<T>&, const size_t)
+{
+	return src;
+}
+
+template<typename To, typename From, size_t X, size_t Y, size_t Z>
+volume<To, X, Y, Z> voxel_cast(const volume<From, X, Y, Z>& v)
+{
+	volume<To, X, Y, Z> result;
+	voxel_convert(v.data(), result.data(), volume<To, X, Y, Z>::size);
+	return result;
+}